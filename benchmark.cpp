@@ -0,0 +1,83 @@
+// benchmark: emulation speed for a rom, without any output, in fresh instances sharing the rom image
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+
+#include "snes.h"
+#include "romimage.h"
+#include "movie.h"
+
+static int compareDouble(const void* a, const void* b) {
+  double da = *(const double*) a;
+  double db = *(const double*) b;
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+int main(int argc, char** argv) {
+  if(argc < 2) {
+    puts("usage: lakesnes_benchmark rom [frames (1000)] [runs (5)] [input movie]");
+    return 1;
+  }
+  int frames = argc >= 3 ? atoi(argv[2]) : 1000;
+  int runs = argc >= 4 ? atoi(argv[3]) : 5;
+  if(frames <= 0 || runs <= 0) {
+    puts("frames and runs should be positive");
+    return 1;
+  }
+  LakeSnes::RomImage* image = LakeSnes::RomImage::romimage_load(argv[1]);
+  if(image == NULL) {
+    printf("Failed to read file '%s'\n", argv[1]);
+    return 1;
+  }
+  Movie* movie = NULL;
+  if(argc >= 5) {
+    movie = movie_load(argv[4]);
+    if(movie == NULL) {
+      image->romimage_release();
+      return 1;
+    }
+  }
+  uint8_t* pixels = (uint8_t*)malloc(512 * 4 * 478);
+  double* times = (double*)malloc(runs * sizeof(double));
+  for(int run = 0; run < runs; run++) {
+    LakeSnes::Snes* snes = new LakeSnes::Snes();
+    LakeSnes::SnesConfig config;
+    config.pixelBuffer = pixels;
+    snes->snes_init(&config);
+    if(!snes->snes_loadRomImage(image)) {
+      snes->snes_free();
+      delete snes;
+      movie_free(movie);
+      image->romimage_release();
+      return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < frames; i++) {
+      if(movie != NULL) {
+        snes->myinput[0].currentState = movie_getButtons(movie, i, 1);
+        snes->myinput[1].currentState = movie_getButtons(movie, i, 2);
+      }
+      snes->snes_runFrame();
+    }
+    auto end = std::chrono::steady_clock::now();
+    times[run] = std::chrono::duration<double, std::milli>(end - start).count();
+    printf("run %d: %.1f ms, %.3f ms/frame\n", run + 1, times[run], times[run] / frames);
+    snes->snes_free();
+    delete snes;
+  }
+  qsort(times, runs, sizeof(double), compareDouble);
+  double best = times[0];
+  double median = times[runs / 2];
+  printf(
+    "best %.3f ms/frame (%.1f fps), median %.3f ms/frame (%.1f fps)\n",
+    best / frames, frames * 1000.0 / best, median / frames, frames * 1000.0 / median
+  );
+  free(times);
+  free(pixels);
+  movie_free(movie);
+  image->romimage_release();
+  return 0;
+}
@@ -0,0 +1,555 @@
+// dspcheck: runs randomized register and aram write streams through the dsp and through a reference copy of
+// the dsp as it was before the 8-lane voice stages, brr cache and simd paths, and reports the first sample where
+// their output, registers or aram differ
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "snes.h"
+
+namespace
+{
+  int clamp16(int val) {
+    return val < -0x8000 ? -0x8000 : (val > 0x7fff ? 0x7fff : val);
+  }
+
+  int clip16(int val) {
+    return (int16_t) (val & 0xffff);
+  }
+
+  const int rateValues[32] = {
+    0, 2048, 1536, 1280, 1024, 768, 640, 512,
+    384, 320, 256, 192, 160, 128, 96, 80,
+    64, 48, 40, 32, 24, 20, 16, 12,
+    10, 8, 6, 5, 4, 3, 2, 1
+  };
+
+  const int rateOffsets[32] = {
+    0, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536,
+    0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0
+  };
+
+  const int gaussValues[512] = {
+    0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
+    0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x002, 0x002, 0x002, 0x002, 0x002,
+    0x002, 0x002, 0x003, 0x003, 0x003, 0x003, 0x003, 0x004, 0x004, 0x004, 0x004, 0x004, 0x005, 0x005, 0x005, 0x005,
+    0x006, 0x006, 0x006, 0x006, 0x007, 0x007, 0x007, 0x008, 0x008, 0x008, 0x009, 0x009, 0x009, 0x00a, 0x00a, 0x00a,
+    0x00b, 0x00b, 0x00b, 0x00c, 0x00c, 0x00d, 0x00d, 0x00e, 0x00e, 0x00f, 0x00f, 0x00f, 0x010, 0x010, 0x011, 0x011,
+    0x012, 0x013, 0x013, 0x014, 0x014, 0x015, 0x015, 0x016, 0x017, 0x017, 0x018, 0x018, 0x019, 0x01a, 0x01b, 0x01b,
+    0x01c, 0x01d, 0x01d, 0x01e, 0x01f, 0x020, 0x020, 0x021, 0x022, 0x023, 0x024, 0x024, 0x025, 0x026, 0x027, 0x028,
+    0x029, 0x02a, 0x02b, 0x02c, 0x02d, 0x02e, 0x02f, 0x030, 0x031, 0x032, 0x033, 0x034, 0x035, 0x036, 0x037, 0x038,
+    0x03a, 0x03b, 0x03c, 0x03d, 0x03e, 0x040, 0x041, 0x042, 0x043, 0x045, 0x046, 0x047, 0x049, 0x04a, 0x04c, 0x04d,
+    0x04e, 0x050, 0x051, 0x053, 0x054, 0x056, 0x057, 0x059, 0x05a, 0x05c, 0x05e, 0x05f, 0x061, 0x063, 0x064, 0x066,
+    0x068, 0x06a, 0x06b, 0x06d, 0x06f, 0x071, 0x073, 0x075, 0x076, 0x078, 0x07a, 0x07c, 0x07e, 0x080, 0x082, 0x084,
+    0x086, 0x089, 0x08b, 0x08d, 0x08f, 0x091, 0x093, 0x096, 0x098, 0x09a, 0x09c, 0x09f, 0x0a1, 0x0a3, 0x0a6, 0x0a8,
+    0x0ab, 0x0ad, 0x0af, 0x0b2, 0x0b4, 0x0b7, 0x0ba, 0x0bc, 0x0bf, 0x0c1, 0x0c4, 0x0c7, 0x0c9, 0x0cc, 0x0cf, 0x0d2,
+    0x0d4, 0x0d7, 0x0da, 0x0dd, 0x0e0, 0x0e3, 0x0e6, 0x0e9, 0x0ec, 0x0ef, 0x0f2, 0x0f5, 0x0f8, 0x0fb, 0x0fe, 0x101,
+    0x104, 0x107, 0x10b, 0x10e, 0x111, 0x114, 0x118, 0x11b, 0x11e, 0x122, 0x125, 0x129, 0x12c, 0x130, 0x133, 0x137,
+    0x13a, 0x13e, 0x141, 0x145, 0x148, 0x14c, 0x150, 0x153, 0x157, 0x15b, 0x15f, 0x162, 0x166, 0x16a, 0x16e, 0x172,
+    0x176, 0x17a, 0x17d, 0x181, 0x185, 0x189, 0x18d, 0x191, 0x195, 0x19a, 0x19e, 0x1a2, 0x1a6, 0x1aa, 0x1ae, 0x1b2,
+    0x1b7, 0x1bb, 0x1bf, 0x1c3, 0x1c8, 0x1cc, 0x1d0, 0x1d5, 0x1d9, 0x1dd, 0x1e2, 0x1e6, 0x1eb, 0x1ef, 0x1f3, 0x1f8,
+    0x1fc, 0x201, 0x205, 0x20a, 0x20f, 0x213, 0x218, 0x21c, 0x221, 0x226, 0x22a, 0x22f, 0x233, 0x238, 0x23d, 0x241,
+    0x246, 0x24b, 0x250, 0x254, 0x259, 0x25e, 0x263, 0x267, 0x26c, 0x271, 0x276, 0x27b, 0x280, 0x284, 0x289, 0x28e,
+    0x293, 0x298, 0x29d, 0x2a2, 0x2a6, 0x2ab, 0x2b0, 0x2b5, 0x2ba, 0x2bf, 0x2c4, 0x2c9, 0x2ce, 0x2d3, 0x2d8, 0x2dc,
+    0x2e1, 0x2e6, 0x2eb, 0x2f0, 0x2f5, 0x2fa, 0x2ff, 0x304, 0x309, 0x30e, 0x313, 0x318, 0x31d, 0x322, 0x326, 0x32b,
+    0x330, 0x335, 0x33a, 0x33f, 0x344, 0x349, 0x34e, 0x353, 0x357, 0x35c, 0x361, 0x366, 0x36b, 0x370, 0x374, 0x379,
+    0x37e, 0x383, 0x388, 0x38c, 0x391, 0x396, 0x39b, 0x39f, 0x3a4, 0x3a9, 0x3ad, 0x3b2, 0x3b7, 0x3bb, 0x3c0, 0x3c5,
+    0x3c9, 0x3ce, 0x3d2, 0x3d7, 0x3dc, 0x3e0, 0x3e5, 0x3e9, 0x3ed, 0x3f2, 0x3f6, 0x3fb, 0x3ff, 0x403, 0x408, 0x40c,
+    0x410, 0x415, 0x419, 0x41d, 0x421, 0x425, 0x42a, 0x42e, 0x432, 0x436, 0x43a, 0x43e, 0x442, 0x446, 0x44a, 0x44e,
+    0x452, 0x455, 0x459, 0x45d, 0x461, 0x465, 0x468, 0x46c, 0x470, 0x473, 0x477, 0x47a, 0x47e, 0x481, 0x485, 0x488,
+    0x48c, 0x48f, 0x492, 0x496, 0x499, 0x49c, 0x49f, 0x4a2, 0x4a6, 0x4a9, 0x4ac, 0x4af, 0x4b2, 0x4b5, 0x4b7, 0x4ba,
+    0x4bd, 0x4c0, 0x4c3, 0x4c5, 0x4c8, 0x4cb, 0x4cd, 0x4d0, 0x4d2, 0x4d5, 0x4d7, 0x4d9, 0x4dc, 0x4de, 0x4e0, 0x4e3,
+    0x4e5, 0x4e7, 0x4e9, 0x4eb, 0x4ed, 0x4ef, 0x4f1, 0x4f3, 0x4f5, 0x4f6, 0x4f8, 0x4fa, 0x4fb, 0x4fd, 0x4ff, 0x500,
+    0x502, 0x503, 0x504, 0x506, 0x507, 0x508, 0x50a, 0x50b, 0x50c, 0x50d, 0x50e, 0x50f, 0x510, 0x511, 0x511, 0x512,
+    0x513, 0x514, 0x514, 0x515, 0x516, 0x516, 0x517, 0x517, 0x517, 0x518, 0x518, 0x518, 0x518, 0x518, 0x519, 0x519
+  };
+
+  struct RefChannel
+  {
+    uint16_t pitch;
+    uint16_t pitchCounter;
+    bool pitchModulation;
+    int16_t decodeBuffer[12];
+    uint8_t bufferOffset;
+    uint8_t srcn;
+    uint16_t decodeOffset;
+    uint8_t blockOffset;
+    uint8_t brrHeader;
+    bool useNoise;
+    uint8_t startDelay;
+    uint8_t adsrRates[4];
+    uint8_t adsrState;
+    uint8_t sustainLevel;
+    uint8_t gainSustainLevel;
+    bool useGain;
+    uint8_t gainMode;
+    bool directGain;
+    uint16_t gainValue;
+    uint16_t preclampGain;
+    uint16_t gain;
+    bool keyOn;
+    bool keyOff;
+    int16_t sampleOut;
+    int8_t volumeL;
+    int8_t volumeR;
+    bool echoEnable;
+  };
+
+  // the dsp, one voice at a time, with its own copy of aram
+  struct RefDsp
+  {
+    uint8_t aram[0x10000];
+    uint8_t ram[0x80];
+    RefChannel channel[8];
+    uint16_t counter;
+    uint16_t dirPage;
+    bool evenCycle;
+    bool mute;
+    bool reset;
+    int8_t masterVolumeL;
+    int8_t masterVolumeR;
+    int16_t sampleOutL;
+    int16_t sampleOutR;
+    int16_t echoOutL;
+    int16_t echoOutR;
+    int16_t noiseSample;
+    uint8_t noiseRate;
+    bool echoWrites;
+    int8_t echoVolumeL;
+    int8_t echoVolumeR;
+    int8_t feedbackVolume;
+    uint16_t echoBufferAdr;
+    uint16_t echoDelay;
+    uint16_t echoLength;
+    uint16_t echoBufferIndex;
+    uint8_t firBufferIndex;
+    int8_t firValues[8];
+    int16_t firBufferL[8];
+    int16_t firBufferR[8];
+
+    void powerOn() {
+      memset(this, 0, sizeof(*this));
+      ram[0x7c] = 0xff;
+      evenCycle = true;
+      mute = true;
+      reset = true;
+      noiseSample = 0x4000;
+    }
+
+    bool checkCounter(int rate) {
+      if(rate == 0) return false;
+      return ((counter + rateOffsets[rate]) % rateValues[rate]) == 0;
+    }
+
+    void cycle() {
+      sampleOutL = 0;
+      sampleOutR = 0;
+      echoOutL = 0;
+      echoOutR = 0;
+      for(int i = 0; i < 8; i++) {
+        cycleChannel(i);
+      }
+      handleEcho();
+      counter = counter == 0 ? 30720 : counter - 1;
+      if(checkCounter(noiseRate)) {
+        int bit = (noiseSample & 1) ^ ((noiseSample >> 1) & 1);
+        noiseSample = ((noiseSample >> 1) & 0x3fff) | (bit << 14);
+      }
+      evenCycle = !evenCycle;
+      if(mute) {
+        sampleOutL = 0;
+        sampleOutR = 0;
+      }
+    }
+
+    void handleEcho() {
+      firBufferIndex++;
+      firBufferIndex &= 0x7;
+      uint16_t adr = echoBufferAdr + echoBufferIndex;
+      int16_t ramSample = aram[adr] | (aram[(adr + 1) & 0xffff] << 8);
+      firBufferL[firBufferIndex] = ramSample >> 1;
+      ramSample = aram[(adr + 2) & 0xffff] | (aram[(adr + 3) & 0xffff] << 8);
+      firBufferR[firBufferIndex] = ramSample >> 1;
+      int sumL = 0, sumR = 0;
+      for(int i = 0; i < 8; i++) {
+        sumL += (firBufferL[(firBufferIndex + i + 1) & 0x7] * firValues[i]) >> 6;
+        sumR += (firBufferR[(firBufferIndex + i + 1) & 0x7] * firValues[i]) >> 6;
+        if(i == 6) {
+          sumL = clip16(sumL);
+          sumR = clip16(sumR);
+        }
+      }
+      sumL = clamp16(sumL) & ~1;
+      sumR = clamp16(sumR) & ~1;
+      sampleOutL = clamp16(((sampleOutL * masterVolumeL) >> 7) + ((sumL * echoVolumeL) >> 7));
+      sampleOutR = clamp16(((sampleOutR * masterVolumeR) >> 7) + ((sumR * echoVolumeR) >> 7));
+      int echoL = clamp16(echoOutL + clip16((sumL * feedbackVolume) >> 7)) & ~1;
+      int echoR = clamp16(echoOutR + clip16((sumR * feedbackVolume) >> 7)) & ~1;
+      if(echoWrites) {
+        aram[adr] = echoL & 0xff;
+        aram[(adr + 1) & 0xffff] = echoL >> 8;
+        aram[(adr + 2) & 0xffff] = echoR & 0xff;
+        aram[(adr + 3) & 0xffff] = echoR >> 8;
+      }
+      if(echoBufferIndex == 0) {
+        echoLength = echoDelay * 4;
+      }
+      echoBufferIndex += 4;
+      if(echoBufferIndex >= echoLength) {
+        echoBufferIndex = 0;
+      }
+    }
+
+    void cycleChannel(int ch) {
+      RefChannel& c = channel[ch];
+      int pitch = c.pitch;
+      if(ch > 0 && c.pitchModulation) {
+        pitch += ((channel[ch - 1].sampleOut >> 5) * pitch) >> 10;
+      }
+      c.brrHeader = aram[c.decodeOffset];
+      uint16_t samplePointer = dirPage + 4 * c.srcn;
+      if(c.startDelay == 0) samplePointer += 2;
+      uint16_t sampleAdr = aram[samplePointer] | (aram[(samplePointer + 1) & 0xffff] << 8);
+      if(c.startDelay > 0) {
+        if(c.startDelay == 5) {
+          c.decodeOffset = sampleAdr;
+          c.blockOffset = 1;
+          c.bufferOffset = 0;
+          c.brrHeader = 0;
+          ram[0x7c] &= ~(1 << ch);
+        }
+        c.gain = 0;
+        c.startDelay--;
+        c.pitchCounter = 0;
+        if(c.startDelay > 0 && c.startDelay < 4) {
+          c.pitchCounter = 0x4000;
+        }
+        pitch = 0;
+      }
+      int sample = c.useNoise ? clip16(noiseSample * 2) : getSample(ch);
+      sample = ((sample * c.gain) >> 11) & ~1;
+      if(reset || (c.brrHeader & 0x03) == 1) {
+        c.adsrState = 3;
+        c.gain = 0;
+      }
+      if(evenCycle) {
+        if(c.keyOff) {
+          c.adsrState = 3;
+        }
+        if(c.keyOn) {
+          c.startDelay = 5;
+          c.adsrState = 0;
+          c.keyOn = false;
+        }
+      }
+      if(c.startDelay == 0) {
+        handleGain(ch);
+      }
+      if(c.pitchCounter >= 0x4000) {
+        decodeBrr(ch);
+        if(c.blockOffset >= 7) {
+          if(c.brrHeader & 0x1) {
+            c.decodeOffset = sampleAdr;
+            ram[0x7c] |= 1 << ch;
+          } else {
+            c.decodeOffset += 9;
+          }
+          c.blockOffset = 1;
+        } else {
+          c.blockOffset += 2;
+        }
+      }
+      c.pitchCounter &= 0x3fff;
+      c.pitchCounter += pitch;
+      if(c.pitchCounter > 0x7fff) c.pitchCounter = 0x7fff;
+      ram[(ch << 4) | 8] = c.gain >> 4;
+      ram[(ch << 4) | 9] = sample >> 8;
+      c.sampleOut = sample;
+      sampleOutL = clamp16(sampleOutL + ((sample * c.volumeL) >> 7));
+      sampleOutR = clamp16(sampleOutR + ((sample * c.volumeR) >> 7));
+      if(c.echoEnable) {
+        echoOutL = clamp16(echoOutL + ((sample * c.volumeL) >> 7));
+        echoOutR = clamp16(echoOutR + ((sample * c.volumeR) >> 7));
+      }
+    }
+
+    void handleGain(int ch) {
+      RefChannel& c = channel[ch];
+      int newGain = c.gain;
+      int rate = 0;
+      if(c.adsrState == 3) {
+        rate = 31;
+        newGain -= 8;
+      } else if(!c.useGain) {
+        rate = c.adsrRates[c.adsrState];
+        switch(c.adsrState) {
+          case 0: newGain += rate == 31 ? 1024 : 32; break;
+          case 1: newGain -= ((newGain - 1) >> 8) + 1; break;
+          case 2: newGain -= ((newGain - 1) >> 8) + 1; break;
+        }
+      } else if(!c.directGain) {
+        rate = c.adsrRates[3];
+        switch(c.gainMode) {
+          case 0: newGain -= 32; break;
+          case 1: newGain -= ((newGain - 1) >> 8) + 1; break;
+          case 2: newGain += 32; break;
+          case 3: newGain += (c.preclampGain < 0x600) ? 32 : 8; break;
+        }
+      } else {
+        rate = 31;
+        newGain = c.gainValue;
+      }
+      int sustainLevel = c.useGain ? c.gainSustainLevel : c.sustainLevel;
+      if(c.adsrState == 1 && (newGain >> 8) == sustainLevel) {
+        c.adsrState = 2;
+      }
+      c.preclampGain = newGain & 0xffff;
+      if(newGain < 0 || newGain > 0x7ff) {
+        newGain = newGain < 0 ? 0 : 0x7ff;
+        if(c.adsrState == 0) {
+          c.adsrState = 1;
+        }
+      }
+      if(checkCounter(rate)) c.gain = newGain;
+    }
+
+    int16_t getSample(int ch) {
+      RefChannel& c = channel[ch];
+      int pos = (c.pitchCounter >> 12) + c.bufferOffset;
+      int offset = (c.pitchCounter >> 4) & 0xff;
+      int16_t news = c.decodeBuffer[(pos + 3) % 12];
+      int16_t olds = c.decodeBuffer[(pos + 2) % 12];
+      int16_t olders = c.decodeBuffer[(pos + 1) % 12];
+      int16_t oldests = c.decodeBuffer[pos % 12];
+      int out = (gaussValues[0xff - offset] * oldests) >> 11;
+      out += (gaussValues[0x1ff - offset] * olders) >> 11;
+      out += (gaussValues[0x100 + offset] * olds) >> 11;
+      out = clip16(out) + ((gaussValues[offset] * news) >> 11);
+      return clamp16(out) & ~1;
+    }
+
+    void decodeBrr(int ch) {
+      RefChannel& c = channel[ch];
+      int shift = c.brrHeader >> 4;
+      int filter = (c.brrHeader & 0xc) >> 2;
+      int bOff = c.bufferOffset;
+      int old = c.decodeBuffer[bOff == 0 ? 11 : bOff - 1] >> 1;
+      int older = c.decodeBuffer[bOff == 0 ? 10 : bOff - 2] >> 1;
+      uint8_t curByte = 0;
+      for(int i = 0; i < 4; i++) {
+        int s = 0;
+        if(i & 1) {
+          s = curByte & 0xf;
+        } else {
+          curByte = aram[(c.decodeOffset + c.blockOffset + (i >> 1)) & 0xffff];
+          s = curByte >> 4;
+        }
+        if(s > 7) s -= 16;
+        if(shift <= 0xc) {
+          s = (s << shift) >> 1;
+        } else {
+          s = (s >> 3) << 12;
+        }
+        switch(filter) {
+          case 1: s += old + (-old >> 4); break;
+          case 2: s += 2 * old + ((3 * -old) >> 5) - older + (older >> 4); break;
+          case 3: s += 2 * old + ((13 * -old) >> 6) - older + ((3 * older) >> 4); break;
+        }
+        c.decodeBuffer[bOff + i] = clamp16(s) * 2;
+        older = old;
+        old = c.decodeBuffer[bOff + i] >> 1;
+      }
+      c.bufferOffset += 4;
+      if(c.bufferOffset >= 12) c.bufferOffset = 0;
+    }
+
+    void write(uint8_t adr, uint8_t val) {
+      int ch = adr >> 4;
+      switch(adr & 0xf) {
+        case 0x0: channel[ch].volumeL = val; break;
+        case 0x1: channel[ch].volumeR = val; break;
+        case 0x2: channel[ch].pitch = (channel[ch].pitch & 0x3f00) | val; break;
+        case 0x3: channel[ch].pitch = ((channel[ch].pitch & 0x00ff) | (val << 8)) & 0x3fff; break;
+        case 0x4: channel[ch].srcn = val; break;
+        case 0x5: {
+          channel[ch].adsrRates[0] = (val & 0xf) * 2 + 1;
+          channel[ch].adsrRates[1] = ((val & 0x70) >> 4) * 2 + 16;
+          channel[ch].useGain = (val & 0x80) == 0;
+          break;
+        }
+        case 0x6: {
+          channel[ch].adsrRates[2] = val & 0x1f;
+          channel[ch].sustainLevel = (val & 0xe0) >> 5;
+          break;
+        }
+        case 0x7: {
+          channel[ch].directGain = (val & 0x80) == 0;
+          channel[ch].gainMode = (val & 0x60) >> 5;
+          channel[ch].adsrRates[3] = val & 0x1f;
+          channel[ch].gainValue = (val & 0x7f) * 16;
+          channel[ch].gainSustainLevel = (val & 0xe0) >> 5;
+          break;
+        }
+        case 0xf: firValues[ch] = val; break;
+      }
+      switch(adr) {
+        case 0x0c: masterVolumeL = val; break;
+        case 0x1c: masterVolumeR = val; break;
+        case 0x2c: echoVolumeL = val; break;
+        case 0x3c: echoVolumeR = val; break;
+        case 0x4c: for(int i = 0; i < 8; i++) channel[i].keyOn = val & (1 << i); break;
+        case 0x5c: for(int i = 0; i < 8; i++) channel[i].keyOff = val & (1 << i); break;
+        case 0x6c: {
+          reset = val & 0x80;
+          mute = val & 0x40;
+          echoWrites = (val & 0x20) == 0;
+          noiseRate = val & 0x1f;
+          break;
+        }
+        case 0x7c: val = 0; break;
+        case 0x0d: feedbackVolume = val; break;
+        case 0x2d: for(int i = 0; i < 8; i++) channel[i].pitchModulation = val & (1 << i); break;
+        case 0x3d: for(int i = 0; i < 8; i++) channel[i].useNoise = val & (1 << i); break;
+        case 0x4d: for(int i = 0; i < 8; i++) channel[i].echoEnable = val & (1 << i); break;
+        case 0x5d: dirPage = val << 8; break;
+        case 0x6d: echoBufferAdr = val << 8; break;
+        case 0x7d: echoDelay = (val & 0xf) * 512; break;
+      }
+      ram[adr] = val;
+    }
+  };
+
+  uint32_t randomState;
+
+  uint32_t nextRandom() {
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+  }
+
+  // writes to both, the way the spc would
+  void writeDsp(LakeSnes::Dsp* dsp, RefDsp* ref, uint8_t adr, uint8_t val) {
+    dsp->dsp_write(adr, val);
+    ref->write(adr, val);
+  }
+
+  void writeRam(LakeSnes::Apu* apu, RefDsp* ref, uint16_t adr, uint8_t val) {
+    apu->ram[adr] = val;
+    apu->mydsp.dsp_ramWritten(adr);
+    ref->aram[adr] = val;
+  }
+
+  // one register write, biased towards what keeps voices playing and changing
+  void randomDspWrite(LakeSnes::Dsp* dsp, RefDsp* ref) {
+    uint32_t r = nextRandom();
+    uint8_t val = r >> 8;
+    switch(r % 8) {
+      case 0: writeDsp(dsp, ref, 0x4c, val); break; // key on
+      case 1: writeDsp(dsp, ref, 0x5c, val & (val >> 3)); break; // (fewer) key offs
+      case 2: writeDsp(dsp, ref, 0x6c, val & 0x3f); break; // flags, not reset or muted
+      case 3: writeDsp(dsp, ref, ((r >> 16) & 0x70) | 0xf, val); break; // fir
+      default: {
+        uint8_t adr = (r >> 16) & 0x7f;
+        if(adr == 0x6c) val &= (r >> 24) < 8 ? 0xff : 0x7f; // reset only rarely
+        writeDsp(dsp, ref, adr, val);
+        break;
+      }
+    }
+  }
+
+  // some bytes of aram, often in a block a voice is playing (for the brr cache) or in the echo buffer
+  void randomRamWrite(LakeSnes::Apu* apu, RefDsp* ref) {
+    uint32_t r = nextRandom();
+    uint16_t adr = nextRandom();
+    switch(r % 4) {
+      case 0: adr = ref->channel[(r >> 2) & 7].decodeOffset + ((r >> 5) % 9); break;
+      case 1: adr = ref->echoBufferAdr + ((r >> 5) & 0x7ff); break;
+    }
+    int count = 1 + ((r >> 16) & 0xf);
+    for(int i = 0; i < count; i++) {
+      writeRam(apu, ref, adr + i, nextRandom() >> 8);
+    }
+  }
+
+  // the first difference in state visible from outside the dsp (where is the address for registers and aram), or NULL
+  const char* compare(LakeSnes::Apu* apu, RefDsp* ref, bool checkRam, int* where) {
+    LakeSnes::Dsp* dsp = &apu->mydsp;
+    if(dsp->sampleOutL != ref->sampleOutL) return "left output";
+    if(dsp->sampleOutR != ref->sampleOutR) return "right output";
+    for(int i = 0; i < 0x80; i++) {
+      if(dsp->dsp_read(i) != ref->ram[i]) {
+        *where = i;
+        return "dsp register";
+      }
+    }
+    if(checkRam) {
+      for(int i = 0; i < 0x10000; i++) {
+        if(apu->ram[i] != ref->aram[i]) {
+          *where = i;
+          return "aram";
+        }
+      }
+    }
+    return NULL;
+  }
+}
+
+int main(int argc, char** argv) {
+  uint32_t seed = argc >= 2 ? strtoul(argv[1], NULL, 0) : 1;
+  int streams = argc >= 3 ? atoi(argv[2]) : 16;
+  int samples = argc >= 4 ? atoi(argv[3]) : 100000;
+  if(seed == 0 || streams <= 0 || samples <= 0) {
+    puts("usage: lakesnes_dspcheck [seed (1, not 0)] [streams (16)] [samples per stream (100000)]");
+    return 1;
+  }
+  uint8_t* pixels = (uint8_t*)malloc(512 * 4 * 478);
+  LakeSnes::Snes* snes = new LakeSnes::Snes();
+  LakeSnes::SnesConfig config;
+  config.pixelBuffer = pixels;
+  snes->snes_init(&config);
+  LakeSnes::Apu* apu = &snes->myapu;
+  LakeSnes::Dsp* dsp = &apu->mydsp;
+  RefDsp* ref = new RefDsp();
+  int failures = 0;
+  for(int stream = 0; stream < streams; stream++) {
+    randomState = seed + stream * 0x9e3779b9;
+    if(randomState == 0) randomState = 1;
+    dsp->dsp_reset();
+    ref->powerOn();
+    for(int i = 0; i < 0x10000; i++) {
+      writeRam(apu, ref, i, nextRandom() >> 8);
+    }
+    for(int i = 0; i < 0x80; i++) {
+      randomDspWrite(dsp, ref);
+    }
+    writeDsp(dsp, ref, 0x6c, 0x00); // out of reset, unmuted
+    for(int sample = 0; sample < samples; sample++) {
+      uint32_t r = nextRandom();
+      if((r & 0x7) == 0) randomDspWrite(dsp, ref);
+      if((r & 0x78) == 0) randomRamWrite(apu, ref);
+      dsp->dsp_cycle();
+      ref->cycle();
+      int where = -1;
+      const char* difference = compare(apu, ref, (sample & 0xff) == 0xff || sample == samples - 1, &where);
+      if(difference != NULL) {
+        printf("stream %d (seed 0x%08x): %s differs at sample %d", stream, seed + stream * 0x9e3779b9, difference, sample);
+        if(where >= 0) printf(", address $%04x", where);
+        printf(" (dsp %d/%d, reference %d/%d)\n", dsp->sampleOutL, dsp->sampleOutR, ref->sampleOutL, ref->sampleOutR);
+        failures++;
+        break;
+      }
+    }
+  }
+  if(failures == 0) {
+    printf("%d streams of %d samples: bit-exact\n", streams, samples);
+  }
+  delete ref;
+  snes->snes_free();
+  delete snes;
+  free(pixels);
+  return failures == 0 ? 0 : 1;
+}
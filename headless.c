@@ -0,0 +1,103 @@
+// headless frontend: runs a rom for a number of frames without video or audio output, through the C api
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "LakeSnesApi.h"
+#include "movie.h"
+
+static uint64_t hashBytes(uint64_t hash, const uint8_t* data, size_t length) {
+  // fnv-1a
+  for(size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static bool writePpm(const char* path, const uint8_t* pixels) {
+  FILE* f = fopen(path, "wb");
+  if(f == NULL) return false;
+  fprintf(f, "P6\n512 480\n255\n");
+  uint8_t row[512 * 3];
+  for(int y = 0; y < 480; y++) {
+    for(int x = 0; x < 512; x++) {
+      const uint8_t* pixel = pixels + (y * 512 + x) * 4;
+      row[x * 3] = pixel[2];
+      row[x * 3 + 1] = pixel[1];
+      row[x * 3 + 2] = pixel[0];
+    }
+    fwrite(row, sizeof(row), 1, f);
+  }
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* romPath = NULL;
+  const char* ppmPath = NULL;
+  const char* moviePath = NULL;
+  int frames = -1;
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+      frames = atoi(argv[++i]);
+    } else if(strcmp(argv[i], "-ppm") == 0 && i + 1 < argc) {
+      ppmPath = argv[++i];
+    } else if(strcmp(argv[i], "-movie") == 0 && i + 1 < argc) {
+      moviePath = argv[++i];
+    } else if(argv[i][0] != '-' && romPath == NULL) {
+      romPath = argv[i];
+    } else {
+      romPath = NULL;
+      break;
+    }
+  }
+  if(romPath == NULL) {
+    puts("usage: lakesnes_headless rom [-movie input.txt] [-frames n] [-ppm last_frame.ppm]");
+    puts("runs the rom (raw, zip or gz) for n frames (600, or the movie's length), with the input from the movie");
+    puts("if given (see movie.h), and prints a hash of the video and audio it put out");
+    return 1;
+  }
+  Movie* movie = NULL;
+  if(moviePath != NULL) {
+    movie = movie_load(moviePath);
+    if(movie == NULL) return 1;
+  }
+  if(frames < 0) frames = movie != NULL ? movie->frames : 600;
+  lakesnes* snes = lakesnes_create(NULL);
+  if(!lakesnes_loadRomFile(snes, romPath)) {
+    lakesnes_destroy(snes);
+    movie_free(movie);
+    return 1;
+  }
+  int samplesPerFrame = lakesnes_isPal(snes) ? 960 : 800; // at 48 kHz
+  int16_t* samples = (int16_t*)malloc(samplesPerFrame * 4);
+  uint8_t* pixels = (uint8_t*)malloc(512 * 480 * 4);
+  uint64_t videoHash = 0xcbf29ce484222325ull;
+  uint64_t audioHash = 0xcbf29ce484222325ull;
+  for(int i = 0; i < frames; i++) {
+    if(movie != NULL) {
+      lakesnes_setButtons(snes, 1, movie_getButtons(movie, i, 1));
+      lakesnes_setButtons(snes, 2, movie_getButtons(movie, i, 2));
+    }
+    lakesnes_runFrame(snes);
+    lakesnes_copyFrame(snes, pixels);
+    videoHash = hashBytes(videoHash, pixels, 512 * 480 * 4);
+    lakesnes_getSamples(snes, samples, samplesPerFrame);
+    audioHash = hashBytes(audioHash, (const uint8_t*) samples, samplesPerFrame * 4);
+  }
+  printf("%d frames, video %016llx, audio %016llx\n", frames, (unsigned long long) videoHash, (unsigned long long) audioHash);
+  int result = 0;
+  if(ppmPath != NULL && !writePpm(ppmPath, pixels)) {
+    printf("Failed to write '%s'\n", ppmPath);
+    result = 1;
+  }
+  free(pixels);
+  free(samples);
+  lakesnes_destroy(snes);
+  movie_free(movie);
+  return result;
+}
@@ -17,14 +17,13 @@
 
 #ifdef _MSC_VER
 #include <direct.h>
-#define strcasecmp _stricmp
 #define mkdir _mkdir
 #endif
 
-#include "zip.h"
-
 #include "snes.h"
+#include "audio.h"
 #include "tracing.h"
+#include "timeline.h"
 
 /* depends on behaviour:
 casting uintX_t to/from intX_t does 'expceted' unsigned<->signed conversion
@@ -52,20 +51,24 @@ static struct {
   // audio
   SDL_AudioDeviceID audioDevice;
   int audioFrequency;
-  int16_t* audioBuffer;
+  LakeSnes::AudioWriter* audioCapture;
   // paths
   char* prefPath;
   const char* pathSeparator;
   // snes, timing
   LakeSnes::Snes* snes;
   float wantedFrames;
-  int wantedSamples;
   // loaded rom
   bool loaded;
   char* romName;
   char* savePath;
   char* statePath;
-  uint8_t pixelBufferRGBX8888_512x239x2[512*239*2*4];
+  // frames as rendered (both fields, rows alternating), handed over by the snes, and the part shown
+  uint8_t frameSlots[3][512*478*4];
+  uint64_t frameSequence; // of the frame in the texture
+  bool tracing;
+  SDL_Rect srcRect;
+  SDL_Rect dstRect;
 } glb = {};
 
 static uint8_t* readFile(const char* name, int* length);
@@ -73,12 +76,17 @@ static void loadRom(const char* path);
 static void closeRom(void);
 static void setPaths(const char* path);
 static void setTitle(const char* path);
-static bool checkExtention(const char* name, bool forZip);
-static void playAudio(void);
+static void audioCallback(void* userdata, Uint8* stream, int len);
 static void renderScreen(void);
+static void toggleCapture(void);
+static int renderSpc(const char* spcPath, const char* wavPath, int seconds);
 static void handleInput(int keyCode, bool pressed);
 
 int main(int argc, char** argv) {
+  // apu-only mode: render a .spc to a wav file as fast as possible, no window or audio device
+  if(argc >= 4 && strcmp(argv[1], "--spc") == 0) {
+    return renderSpc(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : 180);
+  }
   // set up SDL
   if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
     printf("Failed to init SDL: %s\n", SDL_GetError());
@@ -99,11 +107,13 @@ int main(int argc, char** argv) {
     return 1;
   }
   SDL_RenderSetLogicalSize(glb.renderer, 512, 480); // preserve aspect ratio
-  glb.texture = SDL_CreateTexture(glb.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 512, 480);
+  glb.texture = SDL_CreateTexture(glb.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 512, 478);
   if(glb.texture == NULL) {
     printf("Failed to create texture: %s\n", SDL_GetError());
     return 1;
   }
+  glb.srcRect = {0, 0, 512, 224};
+  glb.dstRect = {0, 16, 512, 448};
   // get pref path, create directories
   glb.prefPath = SDL_GetPrefPath("", "LakeSnes");
   char* savePath = (char*)malloc(strlen(glb.prefPath) + 6); // "saves" (5) + '\0'
@@ -130,15 +140,13 @@ int main(int argc, char** argv) {
   want.freq = glb.audioFrequency;
   want.format = AUDIO_S16;
   want.channels = 2;
-  want.samples = 2048;
-  want.callback = NULL; // use queue
+  want.samples = 512;
+  want.callback = audioCallback; // pulls from the snes audio stream
   glb.audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
   if(glb.audioDevice == 0) {
     printf("Failed to open audio device: %s\n", SDL_GetError());
     return 1;
   }
-  glb.audioBuffer = (int16_t*)malloc(glb.audioFrequency / 50 * 4); // *2 for stereo, *2 for sizeof(int16)
-  SDL_PauseAudioDevice(glb.audioDevice, 0);
   // print version
   SDL_version version;
   SDL_version compiledVersion;
@@ -148,13 +156,22 @@ int main(int argc, char** argv) {
     "LakeSnes - Running with SDL %d.%d.%d (compiled with %d.%d.%d)\n",
     version.major, version.minor, version.patch, compiledVersion.major, compiledVersion.minor, compiledVersion.patch
   );
+  #ifdef LAKESNES_CONFIG_TIMELINE
+  LakeSnes::timeline_nameThread("emulation");
+  #endif
   // init snes, load rom
   glb.snes = new LakeSnes::Snes();
   LakeSnes::SnesConfig cfg;
-  cfg.pixelBufferRGBX8888_512x239x2 = glb.pixelBufferRGBX8888_512x239x2;
+  cfg.pixelBuffer = glb.frameSlots[0];
   glb.snes->snes_init(&cfg);
+  uint8_t* slots[3] = {glb.frameSlots[0], glb.frameSlots[1], glb.frameSlots[2]};
+  glb.snes->snes_setFrameSlots(slots);
+  #ifdef LAKESNES_CONFIG_PROFILE
+  glb.snes->snes_setProfiling(true);
+  #endif
+  glb.snes->snes_openAudioStream(glb.audioFrequency, 50);
+  SDL_PauseAudioDevice(glb.audioDevice, 0);
   glb.wantedFrames = 1.0 / 60.0;
-  glb.wantedSamples = glb.audioFrequency / 60;
   glb.loaded = false;
   glb.romName = NULL;
   glb.savePath = NULL;
@@ -186,6 +203,7 @@ int main(int argc, char** argv) {
             case SDLK_o: runOne = true; break;
             case SDLK_p: paused = !paused; break;
             case SDLK_t: turbo = true; break;
+            case SDLK_w: toggleCapture(); break;
             case SDLK_j: {
               char* filePath = (char*)malloc(strlen(glb.prefPath) + 9); // "dump.bin" (8) + '\0'
               strcpy(filePath, glb.prefPath);
@@ -207,6 +225,40 @@ int main(int argc, char** argv) {
               free(filePath);
               break;
             }
+            #ifdef LAKESNES_CONFIG_TRACE
+            case SDLK_y: {
+              // start/stop the execution trace (last 1M instructions)
+              glb.tracing = !glb.tracing;
+              glb.snes->snes_setTracing(glb.tracing ? 0x100000 : 0);
+              puts(glb.tracing ? "Tracing started" : "Tracing stopped");
+              break;
+            }
+            case SDLK_u: {
+              char* filePath = (char*)malloc(strlen(glb.prefPath) + 10); // "trace.txt" (9) + '\0'
+              strcpy(filePath, glb.prefPath);
+              strcat(filePath, "trace.txt");
+              printf("Dumping trace to %s...\n", filePath);
+              dumpTraceCpu(glb.snes, filePath);
+              free(filePath);
+              break;
+            }
+            #endif
+            #ifdef LAKESNES_CONFIG_TIMELINE
+            case SDLK_i: {
+              // start/stop writing the timeline
+              if(LakeSnes::timeline_isOpen()) {
+                LakeSnes::timeline_close();
+                puts("Timeline stopped");
+                break;
+              }
+              char* filePath = (char*)malloc(strlen(glb.prefPath) + 14); // "timeline.json" (13) + '\0'
+              strcpy(filePath, glb.prefPath);
+              strcat(filePath, "timeline.json");
+              if(LakeSnes::timeline_open(filePath)) printf("Writing timeline to %s\n", filePath);
+              free(filePath);
+              break;
+            }
+            #endif
             case SDLK_l: {
               // run one cpu cycle
               glb.snes->snes_runCpuCycle();
@@ -311,24 +363,37 @@ int main(int argc, char** argv) {
           glb.snes->snes_runFrame();
         }
         glb.snes->snes_runFrame();
-        playAudio();
         renderScreen();
       }
     }
 
     SDL_RenderClear(glb.renderer);
-    SDL_RenderCopy(glb.renderer, glb.texture, NULL, NULL);
+    SDL_RenderCopy(glb.renderer, glb.texture, &glb.srcRect, &glb.dstRect);
     SDL_RenderPresent(glb.renderer); // should vsync
   }
+  // stop audio before the snes (and its audio stream) goes away
+  SDL_PauseAudioDevice(glb.audioDevice, 1);
+  SDL_CloseAudioDevice(glb.audioDevice);
+  if(glb.audioCapture) toggleCapture();
+  #ifdef LAKESNES_CONFIG_TIMELINE
+  LakeSnes::timeline_close();
+  #endif
+  #ifdef LAKESNES_CONFIG_PROFILE
+  {
+    // the hottest code of the whole run
+    char* filePath = (char*)malloc(strlen(glb.prefPath) + 12); // "profile.txt" (11) + '\0'
+    strcpy(filePath, glb.prefPath);
+    strcat(filePath, "profile.txt");
+    if(dumpProfile(glb.snes, filePath, 100)) printf("Wrote profile to %s\n", filePath);
+    free(filePath);
+  }
+  #endif
   // close rom (saves battery)
   closeRom();
   // free snes
   glb.snes->snes_free();
   delete glb.snes;
   // clean sdl and free global allocs
-  SDL_PauseAudioDevice(glb.audioDevice, 1);
-  SDL_CloseAudioDevice(glb.audioDevice);
-  free(glb.audioBuffer);
   SDL_free(glb.prefPath);
   if(glb.romName) free(glb.romName);
   if(glb.savePath) free(glb.savePath);
@@ -340,23 +405,104 @@ int main(int argc, char** argv) {
   return 0;
 }
 
-static void playAudio() {
-  glb.snes->snes_setSamples(glb.audioBuffer, glb.wantedSamples);
-  if(SDL_GetQueuedAudioSize(glb.audioDevice) <= glb.wantedSamples * 4 * 6) {
-    // don't queue audio if buffer is still filled
-    SDL_QueueAudio(glb.audioDevice, glb.audioBuffer, glb.wantedSamples * 4);
+static void audioCallback(void* userdata, Uint8* stream, int len) {
+  (void)userdata;
+  // runs on the audio thread; the stream keeps itself filled to about the latency given when opening
+  #ifdef LAKESNES_CONFIG_TIMELINE
+  LakeSnes::timeline_nameThread("audio");
+  #endif
+  glb.snes->snes_readAudioStream((int16_t*) stream, len / 4);
+}
+
+static void toggleCapture() {
+  if(glb.audioCapture) {
+    glb.snes->snes_setAudioSink(NULL, NULL);
+    glb.audioCapture->writer_close();
+    printf("Stopped audio capture (%llu samples)\n", (unsigned long long) glb.audioCapture->framesWritten);
+    delete glb.audioCapture;
+    glb.audioCapture = NULL;
+    return;
+  }
+  char* filePath = (char*)malloc(strlen(glb.prefPath) + 12); // "capture.wav" (11) + '\0'
+  strcpy(filePath, glb.prefPath);
+  strcat(filePath, "capture.wav");
+  LakeSnes::AudioWriter* writer = new LakeSnes::AudioWriter();
+  if(writer->writer_open(filePath, true)) {
+    printf("Capturing audio to %s...\n", filePath);
+    glb.snes->snes_setAudioSink(LakeSnes::AudioWriter::writer_sink, writer);
+    glb.audioCapture = writer;
+  } else {
+    delete writer;
+  }
+  free(filePath);
+}
+
+static int renderSpc(const char* spcPath, const char* wavPath, int seconds) {
+  int length = 0;
+  uint8_t* file = readFile(spcPath, &length);
+  if(file == NULL) {
+    printf("Failed to read file '%s'\n", spcPath);
+    return 1;
+  }
+  LakeSnes::Snes* snes = new LakeSnes::Snes();
+  LakeSnes::SnesConfig cfg;
+  cfg.pixelBuffer = glb.frameSlots[0];
+  snes->snes_init(&cfg);
+  bool loaded = snes->snes_loadSpc(file, length);
+  free(file);
+  LakeSnes::AudioWriter writer;
+  if(!loaded || !writer.writer_open(wavPath, true)) {
+    snes->snes_free();
+    delete snes;
+    return 1;
+  }
+  snes->snes_setAudioSink(LakeSnes::AudioWriter::writer_sink, &writer);
+  uint64_t countFreq = SDL_GetPerformanceFrequency();
+  uint64_t startCount = SDL_GetPerformanceCounter();
+  for(int i = 0; i < seconds; i++) {
+    snes->snes_runApuSamples(LakeSnes::AudioStream::nativeRate);
   }
+  snes->snes_setAudioSink(NULL, NULL);
+  float elapsed = (SDL_GetPerformanceCounter() - startCount) / (float) countFreq;
+  writer.writer_close();
+  uint64_t samples = (uint64_t) seconds * LakeSnes::AudioStream::nativeRate;
+  printf(
+    "Rendered %llu samples (%d s) to %s in %.3f s: %.0f samples/sec, %.1fx realtime\n",
+    (unsigned long long) samples, seconds, wavPath, elapsed, samples / elapsed, seconds / elapsed
+  );
+  snes->snes_free();
+  delete snes;
+  return 0;
 }
 
 static void renderScreen() {
-  void* pixels = NULL;
-  int pitch = 0;
-  if(SDL_LockTexture(glb.texture, NULL, &pixels, &pitch) != 0) {
-    printf("Failed to lock texture: %s\n", SDL_GetError());
-    return;
+  // upload straight from the newest finished frame: a progressive one is every other row, starting at its field
+  LakeSnes::Ppu::FramebufferInfo info;
+  uint64_t sequence;
+  if(glb.snes->snes_acquireFrame(&info, &sequence) == NULL) return;
+  int lines = info.FrameOverscan ? 239 : 224;
+  const uint8_t* pixels = info.Pixels;
+  int pitch = info.Pitch;
+  int rows = lines * 2;
+  if(!info.FrameInterlaced) {
+    pixels += info.EvenFrame ? 0 : pitch;
+    pitch *= 2;
+    rows = lines;
+  }
+  glb.srcRect = {0, 0, 512, rows};
+  glb.dstRect = {0, info.FrameOverscan ? 2 : 16, 512, lines * 2};
+  // the texture holds the previous frame if none were skipped, then only the changed lines need uploading
+  int first = 0, last = rows - 1;
+  if(sequence == glb.frameSequence + 1 && !info.FrameInterlaced) {
+    while(first <= last && !((info.LinesChanged[first >> 6] >> (first & 63)) & 1)) first++;
+    while(last >= first && !((info.LinesChanged[last >> 6] >> (last & 63)) & 1)) last--;
+  }
+  glb.frameSequence = sequence;
+  if(first > last) return; // unchanged
+  SDL_Rect rect = {0, first, 512, last - first + 1};
+  if(SDL_UpdateTexture(glb.texture, &rect, pixels + first * pitch, pitch) != 0) {
+    printf("Failed to update texture: %s\n", SDL_GetError());
   }
-  glb.snes->snes_setPixels((uint8_t*) pixels);
-  SDL_UnlockTexture(glb.texture);
 }
 
 static void handleInput(int keyCode, bool pressed) {
@@ -376,58 +522,22 @@ static void handleInput(int keyCode, bool pressed) {
   }
 }
 
-static bool checkExtention(const char* name, bool forZip) {
-  if(name == NULL) return false;
-  int length = strlen(name);
-  if(length < 4) return false;
-  if(forZip) {
-    if(strcasecmp(name + length - 4, ".zip") == 0) return true;
-  } else {
-    if(strcasecmp(name + length - 4, ".smc") == 0) return true;
-    if(strcasecmp(name + length - 4, ".sfc") == 0) return true;
-  }
-  return false;
-}
-
 static void loadRom(const char* path) {
-  // zip library from https://github.com/kuba--/zip
-  int length = 0;
-  uint8_t* file = NULL;
-  if(checkExtention(path, true)) {
-    struct zip_t* zip = zip_open(path, 0, 'r');
-    if(zip != NULL) {
-      int entries = zip_total_entries(zip);
-      for(int i = 0; i < entries; i++) {
-        zip_entry_openbyindex(zip, i);
-        const char* zipFilename = zip_entry_name(zip);
-        if(checkExtention(zipFilename, false)) {
-          printf("Read \"%s\" from zip\n", zipFilename);
-          size_t size = 0;
-          zip_entry_read(zip, (void**) &file, &size);
-          length = (int) size;
-          break;
-        }
-        zip_entry_close(zip);
-      }
-      zip_close(zip);
-    }
-  } else {
-    file = readFile(path, &length);
-  }
-  if(file == NULL) {
+  // zipped and gzipped roms are handled by the core as well
+  LakeSnes::RomImage* image = LakeSnes::RomImage::romimage_load(path);
+  if(image == NULL) {
     printf("Failed to read file '%s'\n", path);
     return;
   }
   // close currently loaded rom (saves battery)
   closeRom();
   // load new rom
-  if(glb.snes->snes_loadRom(file, length)) {
+  if(glb.snes->snes_loadRomImage(image)) {
     // get rom name and paths, set title
     setPaths(path);
     setTitle(glb.romName);
-    // set wantedFrames and wantedSamples
+    // set wantedFrames
     glb.wantedFrames = 1.0 / (glb.snes->palTiming ? 50.0 : 60.0);
-    glb.wantedSamples = glb.audioFrequency / (glb.snes->palTiming ? 50 : 60);
     glb.loaded = true;
     // load battery for loaded rom
     int size = 0;
@@ -441,7 +551,7 @@ static void loadRom(const char* path) {
       free(saveData);
     }
   } // else, rom load failed, old rom still loaded
-  free(file);
+  image->romimage_release();
 }
 
 static void closeRom() {
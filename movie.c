@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "movie.h"
+
+Movie* movie_load(const char* path) {
+  FILE* f = fopen(path, "r");
+  if(f == NULL) {
+    printf("Failed to read movie '%s'\n", path);
+    return NULL;
+  }
+  Movie* movie = (Movie*)malloc(sizeof(Movie));
+  int capacity = 3600;
+  movie->buttons = (uint16_t*)malloc(capacity * 2 * sizeof(uint16_t));
+  movie->frames = 0;
+  char line[256];
+  int lineNumber = 0;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    lineNumber++;
+    char* comment = strchr(line, '#');
+    if(comment != NULL) *comment = 0;
+    unsigned int player1 = 0, player2 = 0;
+    int count = 1;
+    char extra;
+    int fields = sscanf(line, "%x %x %d %c", &player1, &player2, &count, &extra);
+    if(fields <= 0) continue; // empty or comment only
+    if(fields < 2 || fields > 3 || player1 > 0xffff || player2 > 0xffff || count < 0 || count > 0x1000000) {
+      printf("Malformed line %d in movie '%s'\n", lineNumber, path);
+      fclose(f);
+      movie_free(movie);
+      return NULL;
+    }
+    if(movie->frames + count > capacity) {
+      while(movie->frames + count > capacity) capacity *= 2;
+      movie->buttons = (uint16_t*)realloc(movie->buttons, capacity * 2 * sizeof(uint16_t));
+    }
+    for(int i = 0; i < count; i++) {
+      movie->buttons[movie->frames * 2] = player1;
+      movie->buttons[movie->frames * 2 + 1] = player2;
+      movie->frames++;
+    }
+  }
+  fclose(f);
+  return movie;
+}
+
+void movie_free(Movie* movie) {
+  if(movie == NULL) return;
+  free(movie->buttons);
+  free(movie);
+}
+
+uint16_t movie_getButtons(const Movie* movie, int frame, int player) {
+  if(frame < 0 || frame >= movie->frames) return 0;
+  return movie->buttons[frame * 2 + (player == 2 ? 1 : 0)];
+}
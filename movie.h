@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Input movie: the buttons held on each frame, to replay a session (the headless frontend and the benchmark take one).
+// Text, a line per run of frames: "<player 1 buttons> <player 2 buttons> [frames]", the buttons as a hex mask (bit n
+// for button n, see LAKESNES_BUTTON_*) and frames 1 if left out; '#' starts a comment.
+typedef struct Movie {
+  uint16_t* buttons; // player 1, player 2 for each frame
+  int frames;
+} Movie;
+
+// NULL if the file can't be read or has a malformed line (which is reported)
+Movie* movie_load(const char* path);
+void movie_free(Movie* movie);
+// what player (1 or 2) holds on frame, nothing past the end
+uint16_t movie_getButtons(const Movie* movie, int frame, int player);
+
+#ifdef __cplusplus
+}
+#endif
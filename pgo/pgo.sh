@@ -0,0 +1,98 @@
+#!/usr/bin/env bash
+# profile guided optimization: builds the release and pgo-generate presets, replays every rom in rom_dir with
+# every movie in pgo/movies through the instrumented lakesnes_headless, rebuilds as pgo-use with the profiles and
+# compares lakesnes_benchmark of the two builds.
+# LAKESNES_BOLT=1 also runs llvm-bolt over the pgo build of lakesnes_benchmark, trained on the same corpus.
+# CC/CXX pick the compiler as usual; for clang, llvm-profdata has to be on the path.
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "usage: pgo/pgo.sh rom_dir [benchmark frames (2000)]"
+  exit 1
+fi
+romdir=$1
+frames=${2:-2000}
+cd "$(dirname "$0")/.."
+release=build/release
+pgo=build/pgo
+profile=$pgo/profile
+benchmovie=pgo/movies/play.txt
+
+# nul separated, sorted rom paths; read them with while IFS= read -r -d '' rom so that names with spaces survive.
+# the loops read from fd 3 to keep the emulator off the list
+find_roms() {
+  find "$romdir" -maxdepth 1 -type f \( -iname '*.sfc' -o -iname '*.smc' -o -iname '*.zip' -o -iname '*.gz' \) -print0 | sort -z
+}
+if [ -z "$(find_roms | tr -d '\0')" ]; then
+  echo "no roms (.sfc, .smc, .zip or .gz) in $romdir"
+  exit 1
+fi
+
+bolt=OFF
+if [ "$LAKESNES_BOLT" = 1 ]; then
+  bolt=ON
+fi
+
+echo "== release build"
+cmake --preset release -DLAKESNES_BOLT="$bolt" > /dev/null
+cmake --build --preset release -j
+
+echo "== instrumented build"
+cmake --preset pgo-generate -DLAKESNES_BOLT="$bolt" > /dev/null
+cmake --build --preset pgo-generate -j
+rm -rf "$profile"
+mkdir -p "$profile"
+
+echo "== training"
+while IFS= read -r -d '' rom <&3; do
+  for movie in pgo/movies/*.txt; do
+    echo "$rom, $movie"
+    "$pgo/lakesnes_headless" "$rom" -movie "$movie" > /dev/null
+  done
+done 3< <(find_roms)
+
+# clang writes raw profiles that have to be merged first, gcc's .gcda files are used as they are
+if ls "$profile"/*.profraw > /dev/null 2>&1; then
+  llvm-profdata merge -output="$profile/lakesnes.profdata" "$profile"/*.profraw
+fi
+
+echo "== optimized build"
+cmake --preset pgo-use -DLAKESNES_BOLT="$bolt" > /dev/null
+cmake --build --preset pgo-use -j
+
+if [ "$bolt" = ON ]; then
+  echo "== bolt"
+  binary=$pgo/lakesnes_benchmark
+  llvm-bolt "$binary" -instrument -instrumentation-file="$profile/bolt.fdata" -o "$binary.instrumented"
+  rm -f "$profile/bolt.fdata"
+  while IFS= read -r -d '' rom <&3; do
+    for movie in pgo/movies/*.txt; do
+      "$binary.instrumented" "$rom" "$frames" 1 "$movie" > /dev/null
+    done
+  done 3< <(find_roms)
+  llvm-bolt "$binary" -data="$profile/bolt.fdata" -o "$binary.bolt" \
+    -reorder-blocks=ext-tsp -reorder-functions=hfsort -split-functions -split-all-cold -dyno-stats
+fi
+
+# best ms/frame of a benchmark run
+best() {
+  "$@" | sed -n 's/^best \([0-9.]*\) ms\/frame.*/\1/p'
+}
+
+echo "== lakesnes_benchmark, $frames frames with $benchmovie, best of 5 in ms/frame"
+if [ "$bolt" = ON ]; then
+  printf "%-40s %10s %10s %10s\n" rom release pgo pgo+bolt
+else
+  printf "%-40s %10s %10s\n" rom release pgo
+fi
+while IFS= read -r -d '' rom <&3; do
+  before=$(best "$release/lakesnes_benchmark" "$rom" "$frames" 5 "$benchmovie")
+  after=$(best "$pgo/lakesnes_benchmark" "$rom" "$frames" 5 "$benchmovie")
+  if [ "$bolt" = ON ]; then
+    bolted=$(best "$pgo/lakesnes_benchmark.bolt" "$rom" "$frames" 5 "$benchmovie")
+    printf "%-40s %10s %10s %10s\n" "$(basename "$rom")" "$before" "$after" "$bolted"
+  else
+    printf "%-40s %10s %10s\n" "$(basename "$rom")" "$before" "$after"
+  fi
+done 3< <(find_roms)
@@ -0,0 +1,134 @@
+#include "LakeSnesApi.h"
+#include "snes.h"
+#include "romimage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+struct lakesnes
+{
+	LakeSnes::Snes* snes;
+	uint8_t* ownPixels; // when the config didn't give a buffer
+};
+
+void lakesnes_defaultConfig(lakesnes_config* config) {
+	config->pixels = NULL;
+	config->pixelFormat = LAKESNES_PIXEL_XRGB8888;
+	config->pixelPitch = 0;
+	config->pixelHires = true;
+}
+
+lakesnes* lakesnes_create(const lakesnes_config* config) {
+	lakesnes_config defaults;
+	if(config == NULL) {
+		lakesnes_defaultConfig(&defaults);
+		config = &defaults;
+	}
+	lakesnes* instance = new lakesnes();
+	instance->ownPixels = NULL;
+	LakeSnes::SnesConfig snesConfig;
+	snesConfig.pixelBuffer = config->pixels;
+	snesConfig.pixelFormat = (LakeSnes::PixelFormat) config->pixelFormat;
+	snesConfig.pixelPitch = config->pixelPitch;
+	snesConfig.pixelHires = config->pixelHires;
+	if(snesConfig.pixelBuffer == NULL) {
+		int bytesPerPixel = config->pixelFormat == LAKESNES_PIXEL_XRGB8888 ? 4 : (config->pixelFormat == LAKESNES_PIXEL_INDEXED ? 1 : 2);
+		int pitch = config->pixelPitch != 0 ? config->pixelPitch : bytesPerPixel * (config->pixelHires ? 512 : 256);
+		instance->ownPixels = (uint8_t*)calloc(pitch, 478);
+		snesConfig.pixelBuffer = instance->ownPixels;
+	}
+	instance->snes = new LakeSnes::Snes();
+	instance->snes->snes_init(&snesConfig);
+	return instance;
+}
+
+void lakesnes_destroy(lakesnes* snes) {
+	if(snes == NULL) return;
+	snes->snes->snes_free();
+	delete snes->snes;
+	free(snes->ownPixels);
+	delete snes;
+}
+
+bool lakesnes_loadRom(lakesnes* snes, const uint8_t* data, int length) {
+	return snes->snes->snes_loadRom(data, length);
+}
+
+bool lakesnes_loadRomFile(lakesnes* snes, const char* path) {
+	LakeSnes::RomImage* image = LakeSnes::RomImage::romimage_load(path);
+	if(image == NULL) {
+		printf("Failed to read file '%s'\n", path);
+		return false;
+	}
+	bool loaded = snes->snes->snes_loadRomImage(image);
+	image->romimage_release();
+	return loaded;
+}
+
+bool lakesnes_isPal(lakesnes* snes) {
+	return snes->snes->palTiming;
+}
+
+void lakesnes_reset(lakesnes* snes, bool hard) {
+	snes->snes->snes_reset(hard);
+}
+
+void lakesnes_runFrame(lakesnes* snes) {
+	snes->snes->snes_runFrame();
+}
+
+void lakesnes_setButton(lakesnes* snes, int player, int button, bool pressed) {
+	snes->snes->snes_setButtonState(player, button, pressed);
+}
+
+void lakesnes_setButtons(lakesnes* snes, int player, uint16_t buttons) {
+	snes->snes->myinput[player == 2 ? 1 : 0].currentState = buttons;
+}
+
+void lakesnes_getFrame(lakesnes* snes, lakesnes_frame* frame) {
+	LakeSnes::Ppu::FramebufferInfo info;
+	snes->snes->myppu.GetFramebufferInfo(&info);
+	frame->pixels = info.Pixels;
+	frame->pitch = info.Pitch;
+	frame->width = info.Width;
+	frame->pixelFormat = (int) info.Format;
+	frame->overscan = info.FrameOverscan;
+	frame->interlaced = info.FrameInterlaced;
+	frame->evenFrame = info.EvenFrame;
+	frame->unchanged = info.FrameUnchanged;
+	memcpy(frame->linesChanged, info.LinesChanged, sizeof(frame->linesChanged));
+}
+
+void lakesnes_copyFrame(lakesnes* snes, uint8_t* pixels) {
+	snes->snes->snes_setPixels(pixels);
+}
+
+void lakesnes_getSamples(lakesnes* snes, int16_t* samples, int count) {
+	snes->snes->snes_setSamples(samples, count);
+}
+
+void lakesnes_openAudioStream(lakesnes* snes, int outputRate, int latencyMs) {
+	snes->snes->snes_openAudioStream(outputRate, latencyMs);
+}
+
+void lakesnes_closeAudioStream(lakesnes* snes) {
+	snes->snes->snes_closeAudioStream();
+}
+
+void lakesnes_readAudioStream(lakesnes* snes, int16_t* samples, int count) {
+	snes->snes->snes_readAudioStream(samples, count);
+}
+
+int lakesnes_saveBattery(lakesnes* snes, uint8_t* data) {
+	return snes->snes->snes_saveBattery(data);
+}
+
+bool lakesnes_loadBattery(lakesnes* snes, const uint8_t* data, int size) {
+	return snes->snes->snes_loadBattery((uint8_t*) data, size);
+}
+
+LakeSnes::Snes* lakesnes_getSnes(lakesnes* snes) {
+	return snes->snes;
+}
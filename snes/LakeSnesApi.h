@@ -1,3 +1,112 @@
-#pragma once
-
-#include "snes.h"
+#pragma once
+
+// C interface to the core (lakesnes_core), for hosts that link it in without going through the C++ classes.
+// An instance is one emulated console; functions on one instance are for one thread at a time, except where noted.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(_WIN32) && defined(LAKESNES_SHARED)
+#ifdef LAKESNES_BUILDING
+#define LAKESNES_API __declspec(dllexport)
+#else
+#define LAKESNES_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define LAKESNES_API __attribute__((visibility("default")))
+#else
+#define LAKESNES_API
+#endif
+
+#ifdef __cplusplus
+namespace LakeSnes { class Snes; }
+extern "C" {
+#endif
+
+typedef struct lakesnes lakesnes;
+
+// as LakeSnes::PixelFormat
+enum {
+	LAKESNES_PIXEL_XRGB8888 = 0, // 4 bytes, 0x00rrggbb
+	LAKESNES_PIXEL_RGB565 = 1,
+	LAKESNES_PIXEL_BGR555 = 2,
+	LAKESNES_PIXEL_INDEXED = 3, // cgram index of the main screen
+};
+
+// button numbers for lakesnes_setButton
+enum {
+	LAKESNES_BUTTON_B = 0,
+	LAKESNES_BUTTON_Y = 1,
+	LAKESNES_BUTTON_SELECT = 2,
+	LAKESNES_BUTTON_START = 3,
+	LAKESNES_BUTTON_UP = 4,
+	LAKESNES_BUTTON_DOWN = 5,
+	LAKESNES_BUTTON_LEFT = 6,
+	LAKESNES_BUTTON_RIGHT = 7,
+	LAKESNES_BUTTON_A = 8,
+	LAKESNES_BUTTON_X = 9,
+	LAKESNES_BUTTON_L = 10,
+	LAKESNES_BUTTON_R = 11,
+};
+
+typedef struct lakesnes_config {
+	// where the ppu draws, pixelPitch * 478 bytes (see LakeSnes::SnesConfig); NULL to have the instance allocate it
+	uint8_t* pixels;
+	int pixelFormat; // LAKESNES_PIXEL_*
+	int pixelPitch; // bytes per row, 0 for tightly packed
+	bool pixelHires; // 512 pixels per row, or 256
+} lakesnes_config;
+
+// the frame drawn last, see LakeSnes::Ppu::FramebufferInfo
+typedef struct lakesnes_frame {
+	const uint8_t* pixels;
+	int pitch;
+	int width;
+	int pixelFormat;
+	bool overscan; // 239 lines instead of 224
+	bool interlaced;
+	bool evenFrame;
+	bool unchanged; // same as the previous frame
+	uint64_t linesChanged[4]; // line n is bit n % 64 of word n / 64
+} lakesnes_frame;
+
+// XRGB8888, 512 wide, tightly packed
+LAKESNES_API void lakesnes_defaultConfig(lakesnes_config* config);
+// config NULL for the default
+LAKESNES_API lakesnes* lakesnes_create(const lakesnes_config* config);
+LAKESNES_API void lakesnes_destroy(lakesnes* snes);
+
+// copies data
+LAKESNES_API bool lakesnes_loadRom(lakesnes* snes, const uint8_t* data, int length);
+// raw, zipped or gzipped rom file, shared with any other instance that has the same one loaded
+LAKESNES_API bool lakesnes_loadRomFile(lakesnes* snes, const char* path);
+LAKESNES_API bool lakesnes_isPal(lakesnes* snes);
+LAKESNES_API void lakesnes_reset(lakesnes* snes, bool hard);
+LAKESNES_API void lakesnes_runFrame(lakesnes* snes);
+
+// player 1 or 2, button LAKESNES_BUTTON_*
+LAKESNES_API void lakesnes_setButton(lakesnes* snes, int player, int button, bool pressed);
+// all of them at once, bit n for button n
+LAKESNES_API void lakesnes_setButtons(lakesnes* snes, int player, uint16_t buttons);
+
+LAKESNES_API void lakesnes_getFrame(lakesnes* snes, lakesnes_frame* frame);
+// the frame as a 512x480 XRGB8888 image, line-doubled; for the default config only
+LAKESNES_API void lakesnes_copyFrame(lakesnes* snes, uint8_t* pixels);
+
+// the last frame's audio resampled to count stereo frames (2 * count samples)
+LAKESNES_API void lakesnes_getSamples(lakesnes* snes, int16_t* samples, int count);
+// or streamed: lakesnes_readAudioStream can be called from any one other thread (see Snes::snes_openAudioStream)
+LAKESNES_API void lakesnes_openAudioStream(lakesnes* snes, int outputRate, int latencyMs);
+LAKESNES_API void lakesnes_closeAudioStream(lakesnes* snes);
+LAKESNES_API void lakesnes_readAudioStream(lakesnes* snes, int16_t* samples, int count);
+
+// cart ram: size with data NULL
+LAKESNES_API int lakesnes_saveBattery(lakesnes* snes, uint8_t* data);
+LAKESNES_API bool lakesnes_loadBattery(lakesnes* snes, const uint8_t* data, int size);
+
+#ifdef __cplusplus
+}
+// the instance itself, for everything beyond the above
+LAKESNES_API LakeSnes::Snes* lakesnes_getSnes(lakesnes* snes);
+#endif
@@ -2,6 +2,7 @@
 #include "snes.h"
 #include "spc.h"
 #include "dsp.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -77,6 +78,7 @@ namespace LakeSnes
 	}
 
 	void Apu::apu_runCycles() {
+		LAKESNES_TIMELINE_SCOPE(config.snes, "apu_runCycles");
 		uint64_t sync_to = (uint64_t)config.snes->cycles * (config.snes->palTiming ? apuCyclesPerMasterPal : apuCyclesPerMaster);
 
 		while (cycles < sync_to) {
@@ -121,6 +123,13 @@ namespace LakeSnes
 		return ram[adr];
 	}
 
+	uint8_t Apu::apu_peek(uint16_t adr) {
+		if(romReadable && adr >= 0xffc0) {
+			return bootRom[adr - 0xffc0];
+		}
+		return ram[adr];
+	}
+
 	void Apu::apu_write(uint16_t adr, uint8_t val) {
 		switch(adr) {
 			case 0xf0: {
@@ -172,9 +181,61 @@ namespace LakeSnes
 				break;
 			}
 		}
+		mydsp.dsp_ramWritten(adr);
 		ram[adr] = val;
 	}
 
+	bool Apu::apu_loadSpc(const uint8_t* data, int length) {
+		// .spc layout: 0x25 spc registers, 0x100 ram, 0x10100 dsp registers, 0x101c0 ram under the ipl rom
+		if(length < 0x10200 || memcmp(data, "SNES-SPC700 Sound File Data", 27) != 0) {
+			printf("Failed to load spc: not a valid .spc file\n");
+			return false;
+		}
+		apu_reset();
+		memcpy(ram, data + 0x100, sizeof(ram));
+		memcpy(ram + 0xffc0, data + 0x101c0, 0x40);
+		mydsp.dsp_flushBrrCache(); // ram was written behind its back
+		// io registers, from their ram shadow
+		apu_write(0xf1, ram[0xf1] & 0x87); // timer enables and rom mapping, without clearing the ports
+		dspAdr = ram[0xf2];
+		for(int i = 0; i < 3; i++) {
+			timer[i].target = ram[0xfa + i];
+			timer[i].counter = ram[0xfd + i] & 0xf;
+		}
+		for(int i = 0; i < 4; i++) {
+			inPorts[i] = ram[0xf4 + i];
+		}
+		// dsp registers, key-on last so the voices start from the loaded state
+		const uint8_t* dspRegs = data + 0x10100;
+		for(int i = 0; i < 0x80; i++) {
+			if(i == 0x4c || i == 0x7c) continue;
+			mydsp.dsp_write(i, dspRegs[i]);
+		}
+		mydsp.ram[0x7c] = dspRegs[0x7c]; // writing ENDx would clear it
+		mydsp.dsp_write(0x4c, dspRegs[0x4c] & ~dspRegs[0x5c]);
+		myspc.spc_setRegisters(data[0x25] | (data[0x26] << 8), data[0x27], data[0x28], data[0x29], data[0x2a], data[0x2b]);
+		// id666 tag (text format), if there
+		if(data[0x23] == 0x1a) {
+			char title[33], game[33];
+			memcpy(title, data + 0x2e, 32);
+			memcpy(game, data + 0x4e, 32);
+			title[32] = game[32] = 0;
+			printf("Loaded spc \"%s\" (%s)\n", title, game);
+		} else {
+			puts("Loaded spc");
+		}
+		return true;
+	}
+
+	void Apu::apu_runSamples(int samples) {
+		if(samples <= 0) return;
+		// a sample is made when a cycle starts at a multiple of 32, run through the last one wanted
+		uint64_t lastSample = ((cycles + 31) & ~(uint64_t)0x1f) + (uint64_t)(samples - 1) * 32;
+		while(cycles <= lastSample) {
+			myspc.spc_runOpcode();
+		}
+	}
+
 	uint8_t Apu::apu_spcRead(uint16_t adr) {
 		apu_cycle();
 		return apu_read(adr);
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+
+#include "conf.h"
 
 #include "spc.h"
 #include "dsp.h"
@@ -31,22 +34,30 @@ namespace LakeSnes
 
 		void apu_cycle();
 		uint8_t apu_read(uint16_t adr);
+		uint8_t apu_peek(uint16_t adr); // ram or boot rom as the spc sees it, without side effects (io reads as ram)
 		void apu_write( uint16_t adr, uint8_t val);
 
+		// standalone use, without the cpu side
+		bool apu_loadSpc(const uint8_t* data, int length); // .spc snapshot, resets the apu
+		void apu_runSamples(int samples); // runs until the dsp produced exactly this many samples
+
 	public:
 		struct {
 			Snes* snes;
 		} config;
-		Spc myspc;
-		Dsp mydsp;
-		uint8_t ram[0x10000];
+		// hot: touched by every spc cycle
+		uint64_t cycles;
 		bool romReadable;
 		uint8_t dspAdr;
-		uint64_t cycles;
 		uint8_t inPorts[6]; // includes 2 bytes of ram
 		uint8_t outPorts[4];
 		Timer timer[3];
+		Spc myspc;
+		alignas(LAKESNES_PAGE) uint8_t ram[0x10000];
+		Dsp mydsp; // (its big buffers at its end)
 	};
+	static_assert(offsetof(Apu, myspc) + sizeof(Spc) <= 2 * LAKESNES_CACHE_LINE, "the apu's and spc's registers should fit in two cache lines");
+	static_assert(offsetof(Apu, ram) % LAKESNES_PAGE == 0, "aram should start on a page");
 
 
 
@@ -0,0 +1,240 @@
+#include "audio.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+namespace
+{
+	static const double pi = 3.14159265358979323846;
+
+	// keep the ratio adjustment small enough to be inaudible as pitch change
+	static const double maxRateAdjust = 0.005;
+
+	static double sinc(double x) {
+		if(fabs(x) < 1e-9) return 1.0;
+		return sin(pi * x) / (pi * x);
+	}
+}
+
+namespace LakeSnes
+{
+	void AudioStream::stream_init(int outputRate, int latencyMs) {
+		config.outputRate = outputRate;
+		config.targetFill = nativeRate * latencyMs / 1000;
+		if(config.targetFill < 256) config.targetFill = 256;
+		// ring holds twice the target so there is equal headroom both ways
+		uint32_t size = 1;
+		while(size < (uint32_t) config.targetFill * 2) size <<= 1;
+		mask = size - 1;
+		ring = (AudioFrame*)malloc(size * sizeof(AudioFrame));
+		baseStep = (double) nativeRate / outputRate;
+		// low-pass at the lower of both nyquist frequencies, with some room for the transition band
+		double cutoff = 0.5 * (baseStep > 1.0 ? 1.0 / baseStep : 1.0) * 0.9; // in cycles per input frame
+		for(int p = 0; p <= phases; p++) {
+			double frac = (double) p / phases;
+			float* row = &coefficients[p * taps];
+			double sum = 0;
+			for(int t = 0; t < taps; t++) {
+				// distance from the output position, which lies frac past tap taps / 2 - 1
+				double x = t - (taps / 2 - 1) - frac;
+				double w = (x + taps / 2) / taps; // blackman window over the taps
+				double window = w <= 0 || w >= 1 ? 0 : 0.42 - 0.5 * cos(2 * pi * w) + 0.08 * cos(4 * pi * w);
+				double c = 2 * cutoff * sinc(2 * cutoff * x) * window;
+				row[t] = (float) c;
+				sum += c;
+			}
+			// unity gain at dc for every phase
+			for(int t = 0; t < taps; t++) row[t] = (float) (row[t] / sum);
+		}
+		stream_clear();
+	}
+
+	void AudioStream::stream_free() {
+		free(ring);
+		ring = NULL;
+	}
+
+	void AudioStream::stream_clear() {
+		writePos.store(0);
+		readPos.store(0);
+		memset(historyL, 0, sizeof(historyL));
+		memset(historyR, 0, sizeof(historyR));
+		historyIndex = 0;
+		position = 0;
+		primed = false;
+		lastFrame.left = 0;
+		lastFrame.right = 0;
+		overruns = 0;
+		underruns = 0;
+	}
+
+	int AudioStream::stream_fill() const {
+		return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+	}
+
+	void AudioStream::stream_pushHistory(AudioFrame frame) {
+		historyL[historyIndex] = historyL[historyIndex + taps] = frame.left;
+		historyR[historyIndex] = historyR[historyIndex + taps] = frame.right;
+		historyIndex = (historyIndex + 1) & (taps - 1);
+	}
+
+	void AudioStream::stream_read(int16_t* sampleData, int frames) {
+		// dynamic rate control: consume slightly faster when above the target fill, slower when below
+		uint32_t r = readPos.load(std::memory_order_relaxed);
+		uint32_t available = writePos.load(std::memory_order_acquire) - r;
+		// (re)fill up to the target before playing, instead of running dry right away
+		if(!primed) {
+			if(available < (uint32_t) config.targetFill) {
+				memset(sampleData, 0, frames * 4);
+				return;
+			}
+			primed = true;
+		}
+		double error = ((double) available - config.targetFill) / config.targetFill;
+		if(error > 1.0) error = 1.0;
+		if(error < -1.0) error = -1.0;
+		double step = baseStep * (1.0 + maxRateAdjust * error);
+		// frames up to the snapshot of writePos can't change under us; they are released when done
+		uint32_t used = 0;
+		for(int i = 0; i < frames; i++) {
+			while(position >= 1.0) {
+				if(used < available) {
+					lastFrame = ring[(r + used++) & mask];
+				} else {
+					underruns++; // hold the last frame
+					primed = false;
+				}
+				stream_pushHistory(lastFrame);
+				position -= 1.0;
+			}
+			// interpolate between the two nearest filter phases
+			double phase = position * phases;
+			int p = (int) phase;
+			float f = (float) (phase - p);
+			const float* row0 = &coefficients[p * taps];
+			const float* row1 = row0 + taps;
+			const float* hl = &historyL[historyIndex];
+			const float* hr = &historyR[historyIndex];
+			float accL = 0, accR = 0;
+			for(int t = 0; t < taps; t++) {
+				float c = row0[t] + (row1[t] - row0[t]) * f;
+				accL += hl[t] * c;
+				accR += hr[t] * c;
+			}
+			int outL = (int) lrintf(accL);
+			int outR = (int) lrintf(accR);
+			sampleData[i * 2] = outL < -0x8000 ? -0x8000 : (outL > 0x7fff ? 0x7fff : outL);
+			sampleData[i * 2 + 1] = outR < -0x8000 ? -0x8000 : (outR > 0x7fff ? 0x7fff : outR);
+			position += step;
+		}
+		readPos.store(r + used, std::memory_order_release);
+	}
+
+	bool AudioWriter::writer_open(const char* path, bool wav) {
+		file = fopen(path, "wb");
+		if(file == NULL) {
+			printf("Failed to open '%s' for audio capture\n", path);
+			return false;
+		}
+		this->wav = wav;
+		framesWritten = 0;
+		if(wav) {
+			// placeholder header, sizes are filled in on close
+			uint8_t header[44] = {};
+			fwrite(header, sizeof(header), 1, file);
+		}
+		for(int i = 0; i < blockCount; i++) {
+			blocks[i] = (int16_t*)malloc(blockFrames * 4);
+			if(i > 0) freeBlocks.push_back(blocks[i]);
+		}
+		current = blocks[0];
+		currentFrames = 0;
+		closing = false;
+		thread = std::thread(&AudioWriter::writer_run, this);
+		return true;
+	}
+
+	void AudioWriter::writer_write(const int16_t* sampleData, int frames) {
+		while(frames > 0) {
+			int count = blockFrames - currentFrames;
+			if(count > frames) count = frames;
+			memcpy(&current[currentFrames * 2], sampleData, count * 4);
+			currentFrames += count;
+			sampleData += count * 2;
+			frames -= count;
+			if(currentFrames == blockFrames) writer_submit();
+		}
+	}
+
+	void AudioWriter::writer_submit() {
+		std::unique_lock<std::mutex> guard(lock);
+		fullBlocks.push_back(current);
+		fullSizes.push_back(currentFrames);
+		signal.notify_all();
+		signal.wait(guard, [this] { return !freeBlocks.empty(); });
+		current = freeBlocks.front();
+		freeBlocks.pop_front();
+		currentFrames = 0;
+	}
+
+	void AudioWriter::writer_run() {
+		std::unique_lock<std::mutex> guard(lock);
+		while(true) {
+			signal.wait(guard, [this] { return !fullBlocks.empty() || closing; });
+			if(fullBlocks.empty()) break; // closing, and everything is written
+			int16_t* block = fullBlocks.front();
+			int frames = fullSizes.front();
+			fullBlocks.pop_front();
+			fullSizes.pop_front();
+			guard.unlock();
+			// both formats are s16le, written as is (assumes a little-endian host)
+			fwrite(block, 4, frames, file);
+			guard.lock();
+			framesWritten += frames;
+			freeBlocks.push_back(block);
+			signal.notify_all();
+		}
+	}
+
+	void AudioWriter::writer_close() {
+		if(file == NULL) return;
+		if(currentFrames > 0) writer_submit();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closing = true;
+			signal.notify_all();
+		}
+		thread.join();
+		if(wav) {
+			uint32_t dataSize = (uint32_t) (framesWritten * 4);
+			uint32_t fields[11] = {
+				0x46464952, dataSize + 36, 0x45564157, // "RIFF", size, "WAVE"
+				0x20746d66, 16, 0x00020001, (uint32_t) AudioStream::nativeRate, (uint32_t) AudioStream::nativeRate * 4, 0x00100004, // "fmt ", pcm, stereo, 16 bit
+				0x61746164, dataSize // "data"
+			};
+			uint8_t header[44];
+			for(int i = 0; i < 11; i++) {
+				header[i * 4] = fields[i] & 0xff;
+				header[i * 4 + 1] = (fields[i] >> 8) & 0xff;
+				header[i * 4 + 2] = (fields[i] >> 16) & 0xff;
+				header[i * 4 + 3] = fields[i] >> 24;
+			}
+			fseek(file, 0, SEEK_SET);
+			fwrite(header, sizeof(header), 1, file);
+		}
+		fclose(file);
+		file = NULL;
+		for(int i = 0; i < blockCount; i++) free(blocks[i]);
+		fullBlocks.clear();
+		fullSizes.clear();
+		freeBlocks.clear();
+	}
+
+	void AudioWriter::writer_sink(void* userdata, const int16_t* sampleData, int frames) {
+		((AudioWriter*) userdata)->writer_write(sampleData, frames);
+	}
+
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+#include "audiosink.h"
+
+namespace LakeSnes
+{
+	struct AudioFrame
+	{
+		int16_t left;
+		int16_t right;
+	};
+
+	// Streams the dsp output to the host. The emulation thread pushes every native (32 kHz) stereo frame
+	// into a lock-free single producer / single consumer ring, and the host (typically its audio callback)
+	// pulls frames at its own rate through a windowed-sinc polyphase resampler. The resampling ratio is
+	// nudged by up to +-0.5% depending on how full the ring is, so it stays around the wanted latency.
+	class AudioStream
+	{
+	public:
+		static const int nativeRate = 32040;
+		static const int taps = 16;
+		static const int phases = 64;
+
+		void stream_init(int outputRate, int latencyMs);
+		void stream_free();
+		void stream_clear(); // only while neither side is running
+
+		// producer side (emulation thread)
+		void stream_push(int16_t left, int16_t right) {
+			uint32_t w = writePos.load(std::memory_order_relaxed);
+			if(w - readPos.load(std::memory_order_acquire) > mask) {
+				overruns++; // ring full, drop the frame
+				return;
+			}
+			ring[w & mask].left = left;
+			ring[w & mask].right = right;
+			writePos.store(w + 1, std::memory_order_release);
+		}
+
+		// consumer side (audio thread), always fills all frames (stereo), holding the last frame on underrun
+		void stream_read(int16_t* sampleData, int frames);
+		int stream_fill() const;
+
+	private:
+		void stream_pushHistory(AudioFrame frame);
+
+	public:
+		struct
+		{
+			int outputRate;
+			int targetFill; // wanted ring fill, in native frames
+		} config;
+
+		// ring (power of 2 size), positions are free-running
+		AudioFrame* ring;
+		uint32_t mask;
+		std::atomic<uint32_t> writePos;
+		std::atomic<uint32_t> readPos;
+		// resampler
+		float coefficients[(phases + 1) * taps]; // one row per phase, plus one to interpolate towards
+		float historyL[taps * 2]; // last taps input frames, stored twice so the window never wraps
+		float historyR[taps * 2];
+		int historyIndex;
+		double position; // output position as a fraction past tap taps / 2 - 1 of the window
+		double baseStep; // input frames per output frame
+		AudioFrame lastFrame;
+		bool primed; // false until the ring first reaches the target fill, and again after running dry
+		// statistics
+		uint64_t overruns; // frames dropped because the ring was full (producer)
+		uint64_t underruns; // frames repeated because the ring was empty (consumer)
+	};
+
+	// Lossless capture of the native dsp output to a .wav or raw (interleaved s16le) file. Frames are
+	// collected into large blocks, which a background thread writes out, so the emulation thread never
+	// waits on the disk unless the writer falls a full pool of blocks behind (nothing is dropped).
+	class AudioWriter
+	{
+	public:
+		static const int blockFrames = 0x10000;
+		static const int blockCount = 4;
+
+		bool writer_open(const char* path, bool wav);
+		void writer_write(const int16_t* sampleData, int frames);
+		void writer_close(); // flushes, fixes up the wav header
+		// adapter for Snes::snes_setAudioSink, with the writer as userdata
+		static void writer_sink(void* userdata, const int16_t* sampleData, int frames);
+
+	private:
+		void writer_submit();
+		void writer_run();
+
+	public:
+		FILE* file = NULL;
+		bool wav;
+		uint64_t framesWritten;
+		int16_t* current; // block being filled
+		int currentFrames;
+		int16_t* blocks[blockCount];
+		// handoff to the writing thread
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable signal;
+		std::deque<int16_t*> fullBlocks;
+		std::deque<int> fullSizes;
+		std::deque<int16_t*> freeBlocks;
+		bool closing;
+	};
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace LakeSnes
+{
+	// receives every native (32 kHz) stereo frame the dsp produces, interleaved, in batches, on the emulation thread
+	typedef void (*AudioSink)(void* userdata, const int16_t* sampleData, int frames);
+
+}
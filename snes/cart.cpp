@@ -16,13 +16,23 @@ namespace LakeSnes
 		config.type = 0;
 		config.romSize = 0;
 		config.ramSize = 0;
-		config.rom = NULL;
+		config.romImage = NULL;
+		config.romCopy = NULL;
+		for(int i = 0; i < 0x100; i++) config.romPages[i] = NULL;
 		ram = NULL;
 	}
 
 	void Cart::cart_free() {
-		if(config.rom != NULL) free(config.rom);
+		cart_unload();
+	}
+
+	void Cart::cart_unload() {
+		if(config.romImage != NULL) config.romImage->romimage_release();
+		if(config.romCopy != NULL) free(config.romCopy);
 		if(ram != NULL) free(ram);
+		config.romImage = NULL;
+		config.romCopy = NULL;
+		ram = NULL;
 	}
 
 	void Cart::cart_reset() {
@@ -35,24 +45,50 @@ namespace LakeSnes
 		}
 	}
 
-	void Cart::cart_load(int type, uint8_t* rom, int romSize, int ramSize) {
+	void Cart::cart_load(int type, RomImage* image, int offset, int ramSize) {
+		image->romimage_retain(); // before unloading, it might be the same image
+		cart_unload();
 		config.type = type;
-		if(config.rom != NULL) free(config.rom);
-		if(ram != NULL) free(ram);
+		config.romImage = image;
+		const uint8_t* rom = image->data + offset;
+		int length = image->length - offset;
 
+		// mirrored as if expanded to a power of 2: the part past the highest power of 2 repeats to fill up, recursively
+		int romSize = 0x8000;
+		while(romSize < length) romSize *= 2;
 		config.romSize = romSize;
 		config.ramSize = ramSize;
 
-		//allocate 8MB of data. this way we can pre-mirror the data, which therefore doesn't need to be done at runtime
-		//we've applied the mirroring in a sloppy way, but it's simple at least
-		//I'm not sure what's to be done for e.g. 96 megabit romhacks..
-		config.rom = (uint8_t*)malloc(8*1024*1024);
-		int dst = 0;
-		while(dst < 8*1024*1024)
-		{
-			int sz = std::min(romSize,8*1024*1024-dst);
-			memcpy(config.rom+dst,rom,sz);
-			dst += sz;
+		if(length & 0x7fff) {
+			// odd size, expand a copy (the mirrored parts wouldn't start on page boundaries)
+			config.romCopy = (uint8_t*)malloc(romSize);
+			memcpy(config.romCopy, rom, length);
+			int test = 1;
+			while(length != romSize) {
+				if(length & test) {
+					memcpy(config.romCopy + length, config.romCopy + length - test, test);
+					length += test;
+				}
+				test *= 2;
+			}
+			rom = config.romCopy;
+		}
+		// the 8MB address range repeats the expanded rom, so a page can be found without copying anything
+		for(int i = 0; i < 0x100; i++) {
+			uint32_t at = (i << 15) & (romSize - 1);
+			// undo the expansion: a part past the end mirrors the part of its own size right before it
+			while(at >= (uint32_t) length) {
+				uint32_t filled = length;
+				for(uint32_t test = 0x8000; filled < (uint32_t) romSize; test *= 2) {
+					if(!(filled & test)) continue;
+					if(at < filled + test) {
+						at -= test;
+						break;
+					}
+					filled += test;
+				}
+			}
+			config.romPages[i] = rom + at;
 		}
 
 		if(ramSize > 0) {
@@ -123,14 +159,14 @@ namespace LakeSnes
 		if(RIGHT)
 		{
 			if(a&0x8000)
-				return config.rom[(((b&0x7F) << 15) | (a & 0x7fff))];
+				return config.romPages[b & 0x7f][a & 0x7fff];
 			else
 				return addr.openBus();
 		}
 		else
 		{
 			if(a&0x8000)
-				return config.rom[((b << 15) | (a & 0x7fff))];
+				return config.romPages[b][a & 0x7fff];
 			if((b&0x70)==0x70)
 				return ram[(((b) << 15) | a) & (config.ramSize - 1)];
 			else
@@ -146,7 +182,7 @@ namespace LakeSnes
 		bank &= 0x7f;
 		if(adr >= 0x8000 || bank >= 0x40) {
 			// adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-			return config.rom[((bank << 15) | (adr & 0x7fff)) & (config.romSize - 1)];
+			return cart_romRead(((bank << 15) | (adr & 0x7fff)) & (config.romSize - 1));
 		}
 		return config.snes->OpenBusRef();
 	}
@@ -172,7 +208,7 @@ namespace LakeSnes
 		bank &= 0x7f;
 		if(adr >= 0x8000 || bank >= 0x40) {
 			// adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-			return config.rom[((bank << 15) | (adr & 0x7fff)) & (config.romSize - 1)];
+			return cart_romRead(((bank << 15) | (adr & 0x7fff)) & (config.romSize - 1));
 		}
 		return config.snes->OpenBusRef();
 	}
@@ -198,7 +234,7 @@ namespace LakeSnes
 		}
 		if(adr >= 0x8000 || bank >= 0x40) {
 			// adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-			return config.rom[(((bank & 0x3f) << 16) | adr) & (config.romSize - 1)];
+			return cart_romRead((((bank & 0x3f) << 16) | adr) & (config.romSize - 1));
 		}
 		return config.snes->OpenBusRef();
 	}
@@ -212,7 +248,7 @@ namespace LakeSnes
 		bank &= 0x7f;
 		if(adr >= 0x8000 || bank >= 0x40) {
 			// adr 8000-ffff in all banks or all addresses in banks 40-7f and c0-ff
-			return config.rom[(((bank & 0x3f) << 16) | (secondHalf ? 0x400000 : 0) | adr) & (config.romSize - 1)];
+			return cart_romRead((((bank & 0x3f) << 16) | (secondHalf ? 0x400000 : 0) | adr) & (config.romSize - 1));
 		}
 		return config.snes->OpenBusRef();
 	}
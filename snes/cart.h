@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "Add24.h"
+#include "romimage.h"
 
 namespace LakeSnes
 {
@@ -17,7 +18,8 @@ namespace LakeSnes
 		void cart_init(Snes* snes);
 		void cart_free();
 		void cart_reset(); // will reset special chips etc, general reading is set up in load
-		void cart_load(int type, uint8_t* rom, int romSize, int ramSize); // loads rom, sets up ram buffer
+		// maps the rom (image's data from offset on, which it keeps a reference to), sets up ram buffer
+		void cart_load(int type, RomImage* image, int offset, int ramSize);
 		bool cart_handleBattery(bool save, uint8_t* data, int* size); // saves/loads ram
 		uint8_t cart_read(uint8_t bank, uint16_t adr);
 		void cart_write(uint8_t bank, uint16_t adr, uint8_t val);
@@ -27,6 +29,8 @@ namespace LakeSnes
 
 	private:
 
+		void cart_unload();
+		uint8_t cart_romRead(uint32_t offset) { return config.romPages[(offset >> 15) & 0xff][offset & 0x7fff]; }
 		uint8_t cart_readLorom(uint8_t bank, uint16_t adr);
 		void cart_writeLorom(uint8_t bank, uint16_t adr, uint8_t val);
 		uint8_t cart_readHirom(uint8_t bank, uint16_t adr);
@@ -39,7 +43,10 @@ namespace LakeSnes
 	public:
 		struct {
 			Snes* snes;
-			uint8_t* rom;
+			// the rom as 8MB of 32K pages, mirrored as if expanded to a power of 2 (romSize) and repeated
+			const uint8_t* romPages[0x100];
+			RomImage* romImage;
+			uint8_t* romCopy; // expanded copy, for roms that aren't a multiple of 32K
 			uint32_t romSize;
 			uint32_t ramSize;
 			uint8_t type;
@@ -8,3 +8,31 @@
 #define LAKENES_NOINLINE __attribute__((noinline)) 
 #endif
 #define LAKESNES_UNREACHABLE_DEFAULT default: LAKESNES_UNREACHABLE; break;
+
+//index of the lowest set bit (x must not be 0)
+#ifdef _MSC_VER
+#include <intrin.h>
+static inline int lakesnes_ctz64(unsigned long long x) { unsigned long index; _BitScanForward64(&index, x); return (int)index; }
+#define LAKESNES_CTZ64(x) lakesnes_ctz64(x)
+#else
+#define LAKESNES_CTZ64(x) __builtin_ctzll(x)
+#endif
+
+//bumps a per-frame counter in Snes::stats (see SnesStats), only with LAKESNES_CONFIG_STATS
+#ifdef LAKESNES_CONFIG_STATS
+#define LAKESNES_STAT(snes, counter, n) ((snes)->stats.counter += (n))
+#else
+#define LAKESNES_STAT(snes, counter, n) ((void)0)
+#endif
+
+//layout: hot state is grouped to share as few cache lines as possible, big arrays start on their own pages
+#define LAKESNES_CACHE_LINE 64
+#define LAKESNES_PAGE 4096
+
+//simd paths of the dsp: sse2 on x86 (always there on x64), neon on arm; LAKESNES_CONFIG_NO_SIMD keeps the scalar code
+//(the intrinsics headers are included where they are used)
+#if !defined(LAKESNES_CONFIG_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define LAKESNES_SIMD_SSE2
+#elif !defined(LAKESNES_CONFIG_NO_SIMD) && (defined(__ARM_NEON) || defined(_M_ARM64))
+#define LAKESNES_SIMD_NEON
+#endif
@@ -218,6 +218,7 @@ namespace
 		//.............................
 
 	CASE_WRAM:
+		if(!DMATYPE) LAKESNES_STAT(snes, busWram, 1);
 		at = ((addr.bank() & 1) << 16) | addr.addr();
 		if(READTYPE)
 			rv = snes->ram[at];
@@ -226,6 +227,7 @@ namespace
 		goto CASE_END;
 
 	CASE_LOWRAM:
+		if(!DMATYPE) LAKESNES_STAT(snes, busLowRam, 1);
 		at = addr.addr() & 0x1FFF;
 		if(READTYPE)
 			rv = snes->ram[at];
@@ -234,6 +236,7 @@ namespace
 		goto CASE_END;
 
 	CASE_CARTSPECIAL_LEFTHALF:
+		if(!DMATYPE) LAKESNES_STAT(snes, busCart[0], 1);
 		if(READTYPE)
 			rv = snes->mycart.cart_readLoromByteNew(false,addr);
 		else 
@@ -241,6 +244,7 @@ namespace
 		goto CASE_END;
 
 	CASE_CARTSPECIAL_RIGHTHALF:
+		if(!DMATYPE) LAKESNES_STAT(snes, busCart[1], 1);
 		if(READTYPE)
 			rv = snes->mycart.cart_readLoromByteNew(true,addr);
 		else
@@ -248,6 +252,7 @@ namespace
 		goto CASE_END;
 
 	CASE_IOBLOCK:
+		if(!DMATYPE) LAKESNES_STAT(snes, busIo, 1);
 		if(READTYPE)
 			rv = snes->snes_readIO(addr.addr());
 		else
@@ -277,6 +282,38 @@ namespace LakeSnes
 		cpu_access_new<1,MemOp::DmaWrite>(config.snes,MakeAddr24(bank,adr),val);
 	}
 
+	const uint8_t* Cpu::dma_getReadPointer(uint8_t bank, uint16_t adr, int* length)
+	{
+		//same classification as cpu_access_new
+		Snes* snes = config.snes;
+		if((bank>>1)==0x3F)
+		{
+			*length = 0x10000 - adr;
+			return &snes->ram[((bank & 1) << 16) | adr];
+		}
+		if(adr & 0x8000)
+		{
+			*length = 0x10000 - adr;
+			return &snes->mycart.config.romPages[bank][adr & 0x7fff];
+		}
+		if(adr < 0x2000)
+		{
+			*length = 0x2000 - adr;
+			return &snes->ram[adr];
+		}
+		if(adr >= 0x6000 && (bank&0x70)==0x70 && snes->mycart.ram != NULL)
+		{
+			uint32_t at = ((bank << 15) | adr) & (snes->mycart.config.ramSize - 1);
+			uint32_t toWrap = snes->mycart.config.ramSize - at;
+			*length = 0x8000 - adr;
+			if(toWrap < (uint32_t)*length) *length = toWrap;
+			return &snes->mycart.ram[at];
+		}
+		//io and open bus
+		*length = 0;
+		return NULL;
+	}
+
 	void Cpu::cpu_init(Snes* snes) {
 		config.snes = snes;
 	}
@@ -309,6 +346,9 @@ namespace LakeSnes
 	}
 
 	void Cpu::cpu_runOpcode() {
+		#ifdef LAKESNES_CONFIG_PROFILE
+		ProfileCpuScope profileScope(config.snes->myprofiler.enabled ? &config.snes->myprofiler : NULL);
+		#endif
 		if(resetWanted) {
 			resetWanted = false;
 			// reset: brk/interrupt without writes
@@ -326,8 +366,12 @@ namespace LakeSnes
 			pc = cpu_readWord(MakeAddr24(0,0xfffc),false);
 			goto END;
 		}
+		#ifdef LAKESNES_CONFIG_TRACE
+		if(config.snes->mytracer.enabled) config.snes->mytracer.tracer_record();
+		#endif
 		// not stopped or waiting, execute a opcode or go to interrupt
 		if(intWanted) {
+			LAKESNES_STAT(config.snes, cpuInterrupts, 1);
 			cpu_read(MakeAddr24(k,pc));
 			cpu_doInterrupt();
 		} else {
@@ -2541,6 +2585,7 @@ namespace LakeSnes
 
 	void Cpu::cpu_doOpcode(uint8_t opcode)
 	{
+		LAKESNES_STAT(config.snes, cpuInstructions[_xf][_mf], 1);
 		//looks awkward but runs okay on arm, just a couple of 'cbz' instructions
 		if(_xf)
 			if(_mf)
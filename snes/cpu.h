@@ -25,6 +25,9 @@ namespace LakeSnes
 		//I know, it's not logical to have these on the cpu. hang on.
 		uint8_t dma_read(uint8_t bank, uint16_t adr);
 		void dma_write(uint8_t bank, uint16_t adr, uint8_t val);
+		// direct pointer to what dma_read(bank, adr) reads, for plain memory (wram, rom, sram) only;
+		// *length gets how many bytes from there on stay contiguous (in the same region and bank)
+		const uint8_t* dma_getReadPointer(uint8_t bank, uint16_t adr, int* length);
 
 		void cpu_doOpcode(uint8_t opcode);
 		void _cpu_doOpcode(uint8_t opcode);
@@ -20,6 +20,7 @@
 #include "cx4.h"
 #include "snes.h"
 #include "cpu.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <stdint.h>
@@ -833,6 +834,7 @@ namespace LakeSnes
 
 	void cx4_run()
 	{
+		LAKESNES_TIMELINE_SCOPE(cx4.snes, "cx4_run");
 		int tcyc = 0;
 		tally_cycles();
 
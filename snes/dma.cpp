@@ -1,6 +1,8 @@
 #include "dma.h"
 #include "snes.h"
 #include "cpu.h"
+#include "conf.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,6 +60,8 @@ namespace LakeSnes
 		dmaState = 0;
 		hdmaInitRequested = false;
 		hdmaRunRequested = false;
+		hdmaBatched = false;
+		hdmaBatchCycles = 0;
 	}
 
 	uint8_t Dma::dma_read(uint16_t adr) {
@@ -183,6 +187,7 @@ namespace LakeSnes
 	}
 
 	void Dma::dma_doDma(int cpuCycles) {
+		LAKESNES_TIMELINE_SCOPE(snes, "dma_doDma");
 		// nmi/irq is delayed by 1 opcode if requested during dma/hdma
 		snes->mycpu.intDelay = true;
 		// align to multiple of 8
@@ -194,12 +199,15 @@ namespace LakeSnes
 			// do channel i
 			dma_waitCycle(); // overhead per channel
 			int offIndex = 0;
+			bool bulk = dma_canBulkTransfer(i);
 			while(channel[i].dmaActive) {
+				if(bulk && dma_bulkTransfer(i, &offIndex)) continue;
 				dma_waitCycle();
 				dma_transferByte(
 					channel[i].aAdr, channel[i].aBank,
 					channel[i].bAdr + bAdrOffsets[channel[i].mode][offIndex++], channel[i].fromB
 				);
+				LAKESNES_STAT(snes, dmaBytes, 1);
 				offIndex &= 3;
 				if(!channel[i].fixed) {
 					channel[i].aAdr += channel[i].decrement ? -1 : 1;
@@ -214,6 +222,69 @@ namespace LakeSnes
 		snes->snes_syncCycles(false, cpuCycles);
 	}
 
+	bool Dma::dma_canBulkTransfer(int i) {
+		// a-bus to b-bus, incrementing or fixed, and not to the apu ports (which need the exact cycle to catch up to)
+		if(channel[i].fromB || (channel[i].decrement && !channel[i].fixed)) return false;
+		for(int j = 0; j < 4; j++) {
+			uint8_t bAdr = channel[i].bAdr + bAdrOffsets[channel[i].mode][j];
+			if(bAdr >= 0x40 && bAdr < 0x80) return false;
+		}
+		return true;
+	}
+
+	bool Dma::dma_bulkTransfer(int i, int* offIndex) {
+		// Does as many bytes as possible at once, when they come from plain memory and no positional event
+		// (hdma, h-irq, dram refresh, line render) happens in between: the b-bus writes then don't depend on
+		// the clock, so the clock can be advanced in one go and the writes done in a tight loop.
+		DmaChannel* ch = &channel[i];
+		if(hdmaInitRequested || hdmaRunRequested) return false;
+		int count = snes->snes_cyclesToEvent() / 8;
+		int remaining = ch->size == 0 ? 0x10000 : ch->size;
+		if(count > remaining) count = remaining;
+		int length;
+		const uint8_t* src = snes->mycpu.dma_getReadPointer(ch->aBank, ch->aAdr, &length);
+		if(src == NULL) return false;
+		if(!ch->fixed && count > length) count = length;
+		if(count < 2) return false;
+		snes->snes_skipCycles(count * 8);
+		const int* offsets = bAdrOffsets[ch->mode];
+		int done = 0;
+		if(!ch->fixed && (*offIndex & 1) == 0) {
+			// whole word runs into vram, cgram or oam
+			int words = count / 2;
+			Ppu& ppu = snes->myppu;
+			bool wordPairs = offsets[0] == 0 && offsets[1] == 1 && offsets[2] == 0 && offsets[3] == 1;
+			bool singleReg = offsets[1] == 0 && offsets[2] == 0 && offsets[3] == 0;
+			if(wordPairs && ch->bAdr == 0x18 && ppu.vramIncrementOnHigh && ppu.vramRemapMode == 0) {
+				ppu.ppu_writeVramWords(src, words);
+				done = words * 2;
+			} else if(singleReg && ch->bAdr == 0x22 && !ppu.cgramSecondWrite) {
+				ppu.ppu_writeCgramWords(src, words);
+				done = words * 2;
+			} else if(singleReg && ch->bAdr == 0x04 && !ppu.oamInHigh && !ppu.oamSecondWrite) {
+				done = ppu.ppu_writeOamWords(src, words) * 2;
+			}
+			*offIndex = (*offIndex + done) & 3;
+		}
+		// accessing 0x2180 via b-bus while a-bus accesses ram gives open bus (see dma_transferByte)
+		bool wramSource = ch->aBank == 0x7e || ch->aBank == 0x7f || (
+			(ch->aBank < 0x40 || (ch->aBank >= 0x80 && ch->aBank < 0xc0)) && ch->aAdr < 0x2000
+		);
+		int step = ch->fixed ? 0 : 1;
+		for(; done < count; done++) {
+			uint8_t bAdr = ch->bAdr + offsets[(*offIndex)++];
+			*offIndex &= 3;
+			if(bAdr == 0x80 && wramSource) continue;
+			snes->snes_writeBBus(bAdr, src[done * step]);
+		}
+		if(!ch->fixed) ch->aAdr += count;
+		ch->size -= count;
+		LAKESNES_STAT(snes, dmaBytes, count);
+		LAKESNES_STAT(snes, dmaBulkBytes, count);
+		if(ch->size == 0) ch->dmaActive = false;
+		return true;
+	}
+
 	void Dma::dma_initHdma(bool doSync, int cpuCycles) {
 		hdmaInitRequested = false;
 		bool hdmaEnabled = false;
@@ -261,11 +332,14 @@ namespace LakeSnes
 			}
 		}
 		if(!hdmaActive) return;
+		LAKESNES_TIMELINE_SCOPE(snes, "dma_doHdma");
 		// nmi/irq is delayed by 1 opcode if requested during dma/hdma
 		snes->mycpu.intDelay = true;
 		if(doSync) snes->snes_syncCycles(true, 8);
+		hdmaBatched = dma_canBatchHdma();
+		hdmaBatchCycles = 0;
 		// full transfer overhead
-		snes->snes_runCycles(8);
+		dma_hdmaWait();
 		// do all copies
 		for(int i = 0; i < 8; i++) {
 			// terminate any dma
@@ -274,14 +348,14 @@ namespace LakeSnes
 				// do the hdma
 				if(channel[i].doTransfer) {
 					for(int j = 0; j < transferLength[channel[i].mode]; j++) {
-						snes->snes_runCycles(8);
+						dma_hdmaWait();
 						if(channel[i].indirect) {
-							dma_transferByte(
+							dma_hdmaTransfer(
 								channel[i].size++, channel[i].indBank,
 								channel[i].bAdr + bAdrOffsets[channel[i].mode][j], channel[i].fromB
 							);
 						} else {
-							dma_transferByte(
+							dma_hdmaTransfer(
 								channel[i].tableAdr++, channel[i].aBank,
 								channel[i].bAdr + bAdrOffsets[channel[i].mode][j], channel[i].fromB
 							);
@@ -295,7 +369,7 @@ namespace LakeSnes
 			if(channel[i].hdmaActive && !channel[i].terminated) {
 				channel[i].repCount--;
 				channel[i].doTransfer = channel[i].repCount & 0x80;
-				snes->snes_runCycles(8);
+				dma_hdmaWait();
 				uint8_t newRepCount = snes->mycpu.dma_read(channel[i].aBank, channel[i].tableAdr);
 				if((channel[i].repCount & 0x7f) == 0) {
 					channel[i].repCount = newRepCount;
@@ -305,10 +379,10 @@ namespace LakeSnes
 							// if this is the last active channel, only fetch high, and use 0 for low
 							channel[i].size = 0;
 						} else {
-							snes->snes_runCycles(8);
+							dma_hdmaWait();
 							channel[i].size = snes->mycpu.dma_read(channel[i].aBank, channel[i].tableAdr++);
 						}
-						snes->snes_runCycles(8);
+						dma_hdmaWait();
 						channel[i].size |= snes->mycpu.dma_read(channel[i].aBank, channel[i].tableAdr++) << 8;
 					}
 					if(channel[i].repCount == 0) channel[i].terminated = true;
@@ -316,9 +390,67 @@ namespace LakeSnes
 				}
 			}
 		}
+		if(hdmaBatched) {
+			snes->snes_skipCycles(hdmaBatchCycles);
+			hdmaBatched = false;
+		}
 		if(doSync) snes->snes_syncCycles(false, cpuCycles);
 	}
 
+	bool Dma::dma_isPlainMemory(uint8_t bank, uint16_t adr, int count) {
+		int length;
+		return snes->mycpu.dma_getReadPointer(bank, adr, &length) != NULL && length >= count;
+	}
+
+	bool Dma::dma_canBatchHdma() {
+		// A line's hdma that only reads plain memory (tables and indirect data in wram, rom or sram) and only
+		// writes ppu registers doesn't depend on the clock, as long as no positional event falls within it.
+		// Then the writes go straight to the ppu and the clock is advanced once, by the cycles it took.
+		// The check uses the worst case length, as the table reloads aren't known yet.
+		int cycles = 8;
+		for(int i = 0; i < 8; i++) {
+			if(!channel[i].hdmaActive || channel[i].terminated) continue;
+			int length = transferLength[channel[i].mode];
+			uint16_t tableAdr = channel[i].tableAdr;
+			if(channel[i].doTransfer) {
+				if(channel[i].fromB) return false;
+				for(int j = 0; j < length; j++) {
+					if((uint8_t) (channel[i].bAdr + bAdrOffsets[channel[i].mode][j]) >= 0x40) return false;
+				}
+				if(channel[i].indirect) {
+					if(!dma_isPlainMemory(channel[i].indBank, channel[i].size, length)) return false;
+				} else {
+					if(!dma_isPlainMemory(channel[i].aBank, tableAdr, length)) return false;
+					tableAdr += length;
+				}
+				cycles += length * 8;
+			}
+			// repeat count, and the indirect address on reload
+			int reads = channel[i].indirect ? 3 : 1;
+			if(!dma_isPlainMemory(channel[i].aBank, tableAdr, reads)) return false;
+			cycles += reads * 8;
+		}
+		return cycles <= snes->snes_cyclesToEvent();
+	}
+
+	void Dma::dma_hdmaWait() {
+		if(hdmaBatched) {
+			hdmaBatchCycles += 8;
+		} else {
+			snes->snes_runCycles(8);
+		}
+	}
+
+	void Dma::dma_hdmaTransfer(uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB) {
+		LAKESNES_STAT(snes, hdmaBytes, 1);
+		if(hdmaBatched) {
+			// checked by dma_canBatchHdma: plain memory to a ppu register
+			snes->myppu.ppu_write(bAdr, snes->mycpu.dma_read(aBank, aAdr));
+		} else {
+			dma_transferByte(aAdr, aBank, bAdr, fromB);
+		}
+	}
+
 	void Dma::dma_transferByte(uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB) {
 		// accessing 0x2180 via b-bus while a-bus accesses ram gives open bus
 		bool validB = !(bAdr == 0x80 && (aBank == 0x7e || aBank == 0x7f || (
@@ -43,9 +43,15 @@ namespace LakeSnes
 	private:
 		void dma_transferByte(uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB);
 		void dma_waitCycle();
+		bool dma_canBulkTransfer(int i);
+		bool dma_bulkTransfer(int i, int* offIndex);
 		void dma_doDma(int cpuCycles);
 		void dma_initHdma(bool doSync, int cpuCycles);
 		void dma_doHdma(bool doSync, int cpuCycles);
+		bool dma_isPlainMemory(uint8_t bank, uint16_t adr, int count);
+		bool dma_canBatchHdma();
+		void dma_hdmaWait();
+		void dma_hdmaTransfer(uint16_t aAdr, uint8_t aBank, uint8_t bAdr, bool fromB);
 
 		//MEMBERS:
 		//(for now we peek at some of them, so it's public)
@@ -54,6 +60,9 @@ namespace LakeSnes
 		uint8_t dmaState;
 		bool hdmaInitRequested;
 		bool hdmaRunRequested;
+		// hdma line being done without stepping the clock, and the cycles it took so far
+		bool hdmaBatched;
+		int hdmaBatchCycles;
 		Snes* snes;
 	};
 
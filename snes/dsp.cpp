@@ -1,12 +1,20 @@
 #include "dsp.h"
 #include "apu.h"
+#include "audio.h"
 #include "snes.h"
+#include "conf.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
+#if defined(LAKESNES_SIMD_SSE2)
+#include <emmintrin.h>
+#elif defined(LAKESNES_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace
 {
 	static int clamp16(int val) {
@@ -30,7 +38,7 @@ namespace
 		0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0, 1040, 536, 0
 	};
 
-	static const int gaussValues[512] = {
+	static const int16_t gaussValues[512] = {
 		0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
 		0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x001, 0x002, 0x002, 0x002, 0x002, 0x002,
 		0x002, 0x002, 0x003, 0x003, 0x003, 0x003, 0x003, 0x004, 0x004, 0x004, 0x004, 0x004, 0x005, 0x005, 0x005, 0x005,
@@ -65,6 +73,69 @@ namespace
 		0x513, 0x514, 0x514, 0x515, 0x516, 0x516, 0x517, 0x517, 0x517, 0x518, 0x518, 0x518, 0x518, 0x518, 0x519, 0x519
 	};
 
+	// decodes count samples starting at the high nibble of the byte at adr
+	static void decodeBrrSamples(const uint8_t* aram, int adr, uint8_t header, int old, int older, int16_t* out, int count) {
+		int shift = header >> 4;
+		int filter = (header & 0xc) >> 2;
+		uint8_t curByte = 0;
+		for(int i = 0; i < count; i++) {
+			int s = 0;
+			if(i & 1) {
+				s = curByte & 0xf;
+			} else {
+				curByte = aram[(adr + (i >> 1)) & 0xffff];
+				s = curByte >> 4;
+			}
+			if(s > 7) s -= 16;
+			if(shift <= 0xc) {
+				s = (s << shift) >> 1;
+			} else {
+				s = (s >> 3) << 12;
+			}
+			switch(filter) {
+				case 1: s += old + (-old >> 4); break;
+				case 2: s += 2 * old + ((3 * -old) >> 5) - older + (older >> 4); break;
+				case 3: s += 2 * old + ((13 * -old) >> 6) - older + ((3 * older) >> 4); break;
+			}
+			out[i] = clamp16(s) * 2; // cuts off bit 15
+			older = old;
+			old = out[i] >> 1;
+		}
+	}
+
+#if defined(LAKESNES_SIMD_SSE2)
+	// (a * b) >> shift of 8 16-bit lanes, widened to 32 bits: lanes 0-3 in lo, 4-7 in hi
+	template<int shift> static inline void mulShift(__m128i a, __m128i b, __m128i& lo, __m128i& hi) {
+		__m128i productLo = _mm_mullo_epi16(a, b);
+		__m128i productHi = _mm_mulhi_epi16(a, b);
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(productLo, productHi), shift);
+		hi = _mm_srai_epi32(_mm_unpackhi_epi16(productLo, productHi), shift);
+	}
+
+	// 8 bools as 16-bit lane masks
+	static inline __m128i boolMask16(const bool* flags) {
+		__m128i bytes = _mm_sub_epi8(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i*) flags));
+		return _mm_unpacklo_epi8(bytes, bytes);
+	}
+
+	static inline __m128i clip16(__m128i val) {
+		return _mm_srai_epi32(_mm_slli_epi32(val, 16), 16);
+	}
+#elif defined(LAKESNES_SIMD_NEON)
+	template<int shift> static inline void mulShift(int16x8_t a, int16x8_t b, int32x4_t& lo, int32x4_t& hi) {
+		lo = vshrq_n_s32(vmull_s16(vget_low_s16(a), vget_low_s16(b)), shift);
+		hi = vshrq_n_s32(vmull_s16(vget_high_s16(a), vget_high_s16(b)), shift);
+	}
+
+	static inline uint16x8_t boolMask16(const bool* flags) {
+		return vcgtq_u16(vmovl_u8(vld1_u8((const uint8_t*) flags)), vdupq_n_u16(0));
+	}
+
+	static inline int32x4_t clip16(int32x4_t val) {
+		return vshrq_n_s32(vshlq_n_s32(val, 16), 16);
+	}
+#endif
+
 }
 
 namespace LakeSnes
@@ -72,6 +143,10 @@ namespace LakeSnes
 	void Dsp::dsp_init(Apu* apu) {
 		config.apu = apu;
 		config.snes = apu->config.snes;
+		audioStream = NULL;
+		captureSink = NULL;
+		captureUserdata = NULL;
+		captureCount = 0;
 	}
 
 	void Dsp::dsp_free() {
@@ -81,16 +156,13 @@ namespace LakeSnes
 		memset(ram, 0, sizeof(ram));
 		ram[0x7c] = 0xff; // set ENDx
 		for(int i = 0; i < 8; i++) {
-			channel[i].pitch = 0;
-			channel[i].pitchCounter = 0;	
 			channel[i].pitchModulation = false;
-			memset(channel[i].decodeBuffer, 0, sizeof(channel[i].decodeBuffer));
-			channel[i].bufferOffset = 0;
 			channel[i].srcn = 0;
 			channel[i].decodeOffset = 0;
 			channel[i].blockOffset = 0;
 			channel[i].brrHeader = 0;
-			channel[i].useNoise = false;
+			channel[i].brrCacheSlot = 0;
+			channel[i].brrCached = false;
 			channel[i].startDelay = 0;
 			memset(channel[i].adsrRates, 0, sizeof(channel[i].adsrRates));
 			channel[i].adsrState = 0;
@@ -101,14 +173,10 @@ namespace LakeSnes
 			channel[i].directGain = false;
 			channel[i].gainValue = 0;
 			channel[i].preclampGain = 0;
-			channel[i].gain = 0;
 			channel[i].keyOn = false;
 			channel[i].keyOff = false;
-			channel[i].sampleOut = 0;
-			channel[i].volumeL = 0;
-			channel[i].volumeR = 0;
-			channel[i].echoEnable = false;
 		}
+		memset(&voice, 0, sizeof(voice));
 		counter = 0;
 		dirPage = 0;
 		evenCycle = true;
@@ -137,6 +205,19 @@ namespace LakeSnes
 		memset(sampleBuffer, 0, sizeof(sampleBuffer));
 		sampleOffset = 0;
 		lastFrameBoundary = 0;
+		memset(brrCache, 0, sizeof(brrCache));
+		memset(brrGeneration, 0, sizeof(brrGeneration));
+		brrCacheHits = 0;
+		brrCacheMisses = 0;
+	}
+
+	void Dsp::dsp_flushBrrCache() {
+		for(int i = 0; i < 0x400; i++) {
+			brrCache[i].valid = false;
+		}
+		for(int i = 0; i < 8; i++) {
+			channel[i].brrCached = false;
+		}
 	}
 
 	void Dsp::dsp_newFrame() {
@@ -144,13 +225,18 @@ namespace LakeSnes
 	}
 
 	void Dsp::dsp_cycle() {
-		sampleOutL = 0;
-		sampleOutR = 0;
-		echoOutL = 0;
-		echoOutR = 0;
+		// the voices are handled in stages over all 8 at once; the only state passed from one
+		// voice to the next (pitch modulation and the clamped output sums) is handled in order
+		uint16_t sampleAdr[8];
+		bool starting[8];
+		for(int i = 0; i < 8; i++) {
+			starting[i] = dsp_startChannel(i, &sampleAdr[i]);
+		}
+		dsp_interpolate();
 		for(int i = 0; i < 8; i++) {
-			dsp_cycleChannel(i);
+			dsp_updateChannel(i, sampleAdr[i], starting[i]);
 		}
+		dsp_mixVoices();
 		dsp_handleEcho(); // also applies master volume
 		counter = counter == 0 ? 30720 : counter - 1;
 		dsp_handleNoise();
@@ -163,9 +249,19 @@ namespace LakeSnes
 		// put final sample in the samplebuffer
 		sampleBuffer[(sampleOffset & 0x7ff) * 2] = sampleOutL;
 		sampleBuffer[(sampleOffset++ & 0x7ff) * 2 + 1] = sampleOutR;
+		LAKESNES_STAT(config.snes, dspSamples, 1);
+		if(audioStream) audioStream->stream_push(sampleOutL, sampleOutR);
+		if(captureSink) {
+			captureBuffer[captureCount * 2] = sampleOutL;
+			captureBuffer[captureCount * 2 + 1] = sampleOutR;
+			if(++captureCount == 0x400) dsp_flushCapture();
+		}
 	}
 
-
+	void Dsp::dsp_flushCapture() {
+		if(captureSink && captureCount > 0) captureSink(captureUserdata, captureBuffer, captureCount);
+		captureCount = 0;
+	}
 
 	bool Dsp::dsp_checkCounter(int rate) {
 		if(rate == 0) return false;
@@ -179,20 +275,41 @@ namespace LakeSnes
 		// get value out of ram
 		uint16_t adr = echoBufferAdr + echoBufferIndex;
 		int16_t ramSample = config.apu->ram[adr] | (config.apu->ram[(adr + 1) & 0xffff] << 8);
-		firBufferL[firBufferIndex] = ramSample >> 1;
+		firBufferL[firBufferIndex] = firBufferL[firBufferIndex + 8] = ramSample >> 1;
 		ramSample = config.apu->ram[(adr + 2) & 0xffff] | (config.apu->ram[(adr + 3) & 0xffff] << 8);
-		firBufferR[firBufferIndex] = ramSample >> 1;
-		// calculate FIR-sum
-		int sumL = 0, sumR = 0;
+		firBufferR[firBufferIndex] = firBufferR[firBufferIndex + 8] = ramSample >> 1;
+		// calculate FIR-sum, oldest sample first
+		const int16_t* histL = &firBufferL[firBufferIndex + 1];
+		const int16_t* histR = &firBufferR[firBufferIndex + 1];
+		alignas(16) int tapL[8], tapR[8];
+#if defined(LAKESNES_SIMD_SSE2)
+		__m128i coefficients = _mm_loadl_epi64((const __m128i*) firValues);
+		coefficients = _mm_srai_epi16(_mm_unpacklo_epi8(coefficients, coefficients), 8); // sign extend
+		__m128i tapLo, tapHi;
+		mulShift<6>(_mm_loadu_si128((const __m128i*) histL), coefficients, tapLo, tapHi);
+		_mm_store_si128((__m128i*) &tapL[0], tapLo);
+		_mm_store_si128((__m128i*) &tapL[4], tapHi);
+		mulShift<6>(_mm_loadu_si128((const __m128i*) histR), coefficients, tapLo, tapHi);
+		_mm_store_si128((__m128i*) &tapR[0], tapLo);
+		_mm_store_si128((__m128i*) &tapR[4], tapHi);
+#elif defined(LAKESNES_SIMD_NEON)
+		int16x8_t coefficients = vmovl_s8(vld1_s8(firValues));
+		int32x4_t tapLo, tapHi;
+		mulShift<6>(vld1q_s16(histL), coefficients, tapLo, tapHi);
+		vst1q_s32(&tapL[0], tapLo);
+		vst1q_s32(&tapL[4], tapHi);
+		mulShift<6>(vld1q_s16(histR), coefficients, tapLo, tapHi);
+		vst1q_s32(&tapR[0], tapLo);
+		vst1q_s32(&tapR[4], tapHi);
+#else
 		for(int i = 0; i < 8; i++) {
-			sumL += (firBufferL[(firBufferIndex + i + 1) & 0x7] * firValues[i]) >> 6;
-			sumR += (firBufferR[(firBufferIndex + i + 1) & 0x7] * firValues[i]) >> 6;
-			if(i == 6) {
-				// clip to 16-bit before last addition
-				sumL = clip16(sumL);
-				sumR = clip16(sumR);
-			}
+			tapL[i] = (histL[i] * firValues[i]) >> 6;
+			tapR[i] = (histR[i] * firValues[i]) >> 6;
 		}
+#endif
+		// clip to 16-bit before last addition
+		int sumL = clip16(tapL[0] + tapL[1] + tapL[2] + tapL[3] + tapL[4] + tapL[5] + tapL[6]) + tapL[7];
+		int sumR = clip16(tapR[0] + tapR[1] + tapR[2] + tapR[3] + tapR[4] + tapR[5] + tapR[6]) + tapR[7];
 		sumL = clamp16(sumL) & ~1;
 		sumR = clamp16(sumR) & ~1;
 		// apply master volume and modify output with sum
@@ -203,6 +320,8 @@ namespace LakeSnes
 		int echoR = clamp16(echoOutR + clip16((sumR * feedbackVolume) >> 7)) & ~1;
 		// write it to ram
 		if(echoWrites) {
+			dsp_ramWritten(adr);
+			dsp_ramWritten((adr + 3) & 0xffff);
 			config.apu->ram[adr] = echoL & 0xff;
 			config.apu->ram[(adr + 1) & 0xffff] = echoL >> 8;
 			config.apu->ram[(adr + 2) & 0xffff] = echoR & 0xff;
@@ -218,47 +337,103 @@ namespace LakeSnes
 		}
 	}
 
-	void Dsp::dsp_cycleChannel(int ch) {
-		// handle pitch counter
-		int pitch = channel[ch].pitch;
-		if(ch > 0 && channel[ch].pitchModulation) {
-			pitch += ((channel[ch - 1].sampleOut >> 5) * pitch) >> 10;
-		}
+	bool Dsp::dsp_startChannel(int ch, uint16_t* sampleAdr) {
 		// get current brr header and get sample address
 		channel[ch].brrHeader = config.apu->ram[channel[ch].decodeOffset];
 		uint16_t samplePointer = dirPage + 4 * channel[ch].srcn;
 		if(channel[ch].startDelay == 0) samplePointer += 2;
-		uint16_t sampleAdr = config.apu->ram[samplePointer] | (config.apu->ram[(samplePointer + 1) & 0xffff] << 8);
+		*sampleAdr = config.apu->ram[samplePointer] | (config.apu->ram[(samplePointer + 1) & 0xffff] << 8);
 		// handle starting of sample
-		if(channel[ch].startDelay > 0) {
-			if(channel[ch].startDelay == 5) {
-				// first keyed on
-				channel[ch].decodeOffset = sampleAdr;
-				channel[ch].blockOffset = 1;
-				channel[ch].bufferOffset = 0;
-				channel[ch].brrHeader = 0;
-				ram[0x7c] &= ~(1 << ch); // clear ENDx
-			}
-			channel[ch].gain = 0;
-			channel[ch].startDelay--;
-			channel[ch].pitchCounter = 0;
-			if(channel[ch].startDelay > 0 && channel[ch].startDelay < 4) {
-				channel[ch].pitchCounter = 0x4000;
-			}
-			pitch = 0;
-		}
-		// get sample
-		int sample = 0;
-		if(channel[ch].useNoise) {
-			sample = clip16(noiseSample * 2);
-		} else {
-			sample = dsp_getSample(ch);
+		if(channel[ch].startDelay == 0) return false;
+		if(channel[ch].startDelay == 5) {
+			// first keyed on
+			channel[ch].decodeOffset = *sampleAdr;
+			channel[ch].blockOffset = 1;
+			voice.bufferOffset[ch] = 0;
+			channel[ch].brrHeader = 0;
+			ram[0x7c] &= ~(1 << ch); // clear ENDx
+		}
+		voice.gain[ch] = 0;
+		channel[ch].startDelay--;
+		voice.pitchCounter[ch] = 0;
+		if(channel[ch].startDelay > 0 && channel[ch].startDelay < 4) {
+			voice.pitchCounter[ch] = 0x4000;
+		}
+		return true;
+	}
+
+	void Dsp::dsp_interpolate() {
+		int noise = clip16(noiseSample * 2);
+		// gather the 4 samples each voice interpolates between and their weights into lanes
+		alignas(16) int16_t s0[8], s1[8], s2[8], s3[8], g0[8], g1[8], g2[8], g3[8];
+		for(int ch = 0; ch < 8; ch++) {
+			int pos = (voice.pitchCounter[ch] >> 12) + voice.bufferOffset[ch];
+			int offset = (voice.pitchCounter[ch] >> 4) & 0xff;
+			const int16_t* buf = &voice.decodeBuffer[ch][pos];
+			s0[ch] = buf[0];
+			s1[ch] = buf[1];
+			s2[ch] = buf[2];
+			s3[ch] = buf[3];
+			g0[ch] = gaussValues[0xff - offset];
+			g1[ch] = gaussValues[0x1ff - offset];
+			g2[ch] = gaussValues[0x100 + offset];
+			g3[ch] = gaussValues[offset];
 		}
-		sample = ((sample * channel[ch].gain) >> 11) & ~1;
+		// the weights are at most 0x519 and the gain at most 0x7ff, so all products fit 16x16->32 multiplies
+#if defined(LAKESNES_SIMD_SSE2)
+		__m128i t0Lo, t0Hi, t1Lo, t1Hi, t2Lo, t2Hi, t3Lo, t3Hi;
+		mulShift<11>(_mm_load_si128((const __m128i*) g0), _mm_load_si128((const __m128i*) s0), t0Lo, t0Hi);
+		mulShift<11>(_mm_load_si128((const __m128i*) g1), _mm_load_si128((const __m128i*) s1), t1Lo, t1Hi);
+		mulShift<11>(_mm_load_si128((const __m128i*) g2), _mm_load_si128((const __m128i*) s2), t2Lo, t2Hi);
+		mulShift<11>(_mm_load_si128((const __m128i*) g3), _mm_load_si128((const __m128i*) s3), t3Lo, t3Hi);
+		__m128i outLo = _mm_add_epi32(clip16(_mm_add_epi32(_mm_add_epi32(t0Lo, t1Lo), t2Lo)), t3Lo);
+		__m128i outHi = _mm_add_epi32(clip16(_mm_add_epi32(_mm_add_epi32(t0Hi, t1Hi), t2Hi)), t3Hi);
+		// saturating pack is clamp16
+		const __m128i even = _mm_set1_epi16((int16_t) 0xfffe);
+		__m128i sample = _mm_and_si128(_mm_packs_epi32(outLo, outHi), even);
+		__m128i useNoise = boolMask16(voice.useNoise);
+		sample = _mm_or_si128(_mm_and_si128(useNoise, _mm_set1_epi16((int16_t) noise)), _mm_andnot_si128(useNoise, sample));
+		__m128i gainedLo, gainedHi;
+		mulShift<11>(sample, _mm_loadu_si128((const __m128i*) voice.gain), gainedLo, gainedHi);
+		_mm_storeu_si128((__m128i*) voice.sampleOut, _mm_and_si128(_mm_packs_epi32(gainedLo, gainedHi), even));
+#elif defined(LAKESNES_SIMD_NEON)
+		int32x4_t t0Lo, t0Hi, t1Lo, t1Hi, t2Lo, t2Hi, t3Lo, t3Hi;
+		mulShift<11>(vld1q_s16(g0), vld1q_s16(s0), t0Lo, t0Hi);
+		mulShift<11>(vld1q_s16(g1), vld1q_s16(s1), t1Lo, t1Hi);
+		mulShift<11>(vld1q_s16(g2), vld1q_s16(s2), t2Lo, t2Hi);
+		mulShift<11>(vld1q_s16(g3), vld1q_s16(s3), t3Lo, t3Hi);
+		int32x4_t outLo = vaddq_s32(clip16(vaddq_s32(vaddq_s32(t0Lo, t1Lo), t2Lo)), t3Lo);
+		int32x4_t outHi = vaddq_s32(clip16(vaddq_s32(vaddq_s32(t0Hi, t1Hi), t2Hi)), t3Hi);
+		// saturating narrow is clamp16
+		const int16x8_t even = vdupq_n_s16((int16_t) 0xfffe);
+		int16x8_t sample = vandq_s16(vcombine_s16(vqmovn_s32(outLo), vqmovn_s32(outHi)), even);
+		sample = vbslq_s16(boolMask16(voice.useNoise), vdupq_n_s16((int16_t) noise), sample);
+		int32x4_t gainedLo, gainedHi;
+		mulShift<11>(sample, vreinterpretq_s16_u16(vld1q_u16(voice.gain)), gainedLo, gainedHi);
+		vst1q_s16(voice.sampleOut, vandq_s16(vcombine_s16(vmovn_s32(gainedLo), vmovn_s32(gainedHi)), even));
+#else
+		for(int ch = 0; ch < 8; ch++) {
+			int out = (g0[ch] * s0[ch]) >> 11;
+			out += (g1[ch] * s1[ch]) >> 11;
+			out += (g2[ch] * s2[ch]) >> 11;
+			out = clip16(out) + ((g3[ch] * s3[ch]) >> 11);
+			int sample = voice.useNoise[ch] ? noise : clamp16(out) & ~1;
+			voice.sampleOut[ch] = ((sample * voice.gain[ch]) >> 11) & ~1;
+		}
+#endif
+	}
+
+	void Dsp::dsp_updateChannel(int ch, uint16_t sampleAdr, bool starting) {
+		// handle pitch, modulated by the previous voice's output of this sample
+		int pitch = voice.pitch[ch];
+		if(ch > 0 && channel[ch].pitchModulation) {
+			pitch += ((voice.sampleOut[ch - 1] >> 5) * pitch) >> 10;
+		}
+		if(starting) pitch = 0;
 		// handle reset and release
 		if(reset || (channel[ch].brrHeader & 0x03) == 1) {
 			channel[ch].adsrState = 3; // go to release
-			channel[ch].gain = 0;
+			voice.gain[ch] = 0;
 		}
 		// handle keyon/keyoff
 		if(evenCycle) {
@@ -276,7 +451,7 @@ namespace LakeSnes
 			dsp_handleGain(ch);
 		}
 		// decode new brr samples if needed and update offsets
-		if(channel[ch].pitchCounter >= 0x4000) {
+		if(voice.pitchCounter[ch] >= 0x4000) {
 			dsp_decodeBrr(ch);
 			if(channel[ch].blockOffset >= 7) {
 				if(channel[ch].brrHeader & 0x1) {
@@ -291,23 +466,72 @@ namespace LakeSnes
 			}
 		}
 		// update pitch counter
-		channel[ch].pitchCounter &= 0x3fff;
-		channel[ch].pitchCounter += pitch;
-		if(channel[ch].pitchCounter > 0x7fff) channel[ch].pitchCounter = 0x7fff;
+		voice.pitchCounter[ch] &= 0x3fff;
+		voice.pitchCounter[ch] += pitch;
+		if(voice.pitchCounter[ch] > 0x7fff) voice.pitchCounter[ch] = 0x7fff;
 		// set outputs
-		ram[(ch << 4) | 8] = channel[ch].gain >> 4;
-		ram[(ch << 4) | 9] = sample >> 8;
-		channel[ch].sampleOut = sample;
-		sampleOutL = clamp16(sampleOutL + ((sample * channel[ch].volumeL) >> 7));
-		sampleOutR = clamp16(sampleOutR + ((sample * channel[ch].volumeR) >> 7));
-		if(channel[ch].echoEnable) {
-			echoOutL = clamp16(echoOutL + ((sample * channel[ch].volumeL) >> 7));
-			echoOutR = clamp16(echoOutR + ((sample * channel[ch].volumeR) >> 7));
+		ram[(ch << 4) | 8] = voice.gain[ch] >> 4;
+		ram[(ch << 4) | 9] = voice.sampleOut[ch] >> 8;
+	}
+
+	void Dsp::dsp_mixVoices() {
+		alignas(16) int mixL[8], mixR[8], echoL[8], echoR[8];
+#if defined(LAKESNES_SIMD_SSE2)
+		__m128i sample = _mm_loadu_si128((const __m128i*) voice.sampleOut);
+		__m128i leftLo, leftHi, rightLo, rightHi;
+		mulShift<7>(sample, _mm_loadu_si128((const __m128i*) voice.volumeL), leftLo, leftHi);
+		mulShift<7>(sample, _mm_loadu_si128((const __m128i*) voice.volumeR), rightLo, rightHi);
+		__m128i echoEnable = boolMask16(voice.echoEnable);
+		__m128i echoLo = _mm_unpacklo_epi16(echoEnable, echoEnable);
+		__m128i echoHi = _mm_unpackhi_epi16(echoEnable, echoEnable);
+		_mm_store_si128((__m128i*) &mixL[0], leftLo);
+		_mm_store_si128((__m128i*) &mixL[4], leftHi);
+		_mm_store_si128((__m128i*) &mixR[0], rightLo);
+		_mm_store_si128((__m128i*) &mixR[4], rightHi);
+		_mm_store_si128((__m128i*) &echoL[0], _mm_and_si128(leftLo, echoLo));
+		_mm_store_si128((__m128i*) &echoL[4], _mm_and_si128(leftHi, echoHi));
+		_mm_store_si128((__m128i*) &echoR[0], _mm_and_si128(rightLo, echoLo));
+		_mm_store_si128((__m128i*) &echoR[4], _mm_and_si128(rightHi, echoHi));
+#elif defined(LAKESNES_SIMD_NEON)
+		int16x8_t sample = vld1q_s16(voice.sampleOut);
+		int32x4_t leftLo, leftHi, rightLo, rightHi;
+		mulShift<7>(sample, vld1q_s16(voice.volumeL), leftLo, leftHi);
+		mulShift<7>(sample, vld1q_s16(voice.volumeR), rightLo, rightHi);
+		int16x8_t echoEnable = vreinterpretq_s16_u16(boolMask16(voice.echoEnable));
+		int32x4_t echoLo = vmovl_s16(vget_low_s16(echoEnable));
+		int32x4_t echoHi = vmovl_s16(vget_high_s16(echoEnable));
+		vst1q_s32(&mixL[0], leftLo);
+		vst1q_s32(&mixL[4], leftHi);
+		vst1q_s32(&mixR[0], rightLo);
+		vst1q_s32(&mixR[4], rightHi);
+		vst1q_s32(&echoL[0], vandq_s32(leftLo, echoLo));
+		vst1q_s32(&echoL[4], vandq_s32(leftHi, echoHi));
+		vst1q_s32(&echoR[0], vandq_s32(rightLo, echoLo));
+		vst1q_s32(&echoR[4], vandq_s32(rightHi, echoHi));
+#else
+		for(int ch = 0; ch < 8; ch++) {
+			mixL[ch] = (voice.sampleOut[ch] * voice.volumeL[ch]) >> 7;
+			mixR[ch] = (voice.sampleOut[ch] * voice.volumeR[ch]) >> 7;
+			echoL[ch] = voice.echoEnable[ch] ? mixL[ch] : 0;
+			echoR[ch] = voice.echoEnable[ch] ? mixR[ch] : 0;
+		}
+#endif
+		// clamping after every voice makes the sum order-dependent, so it stays serial
+		int outL = 0, outR = 0, eOutL = 0, eOutR = 0;
+		for(int ch = 0; ch < 8; ch++) {
+			outL = clamp16(outL + mixL[ch]);
+			outR = clamp16(outR + mixR[ch]);
+			eOutL = clamp16(eOutL + echoL[ch]);
+			eOutR = clamp16(eOutR + echoR[ch]);
 		}
+		sampleOutL = outL;
+		sampleOutR = outR;
+		echoOutL = eOutL;
+		echoOutR = eOutR;
 	}
 
 	void Dsp::dsp_handleGain(int ch) {
-		int newGain = channel[ch].gain;
+		int newGain = voice.gain[ch];
 		int rate = 0;
 		// handle gain mode
 		if(channel[ch].adsrState == 3) { // release
@@ -351,55 +575,82 @@ namespace LakeSnes
 			}
 		}
 		// store new value
-		if(dsp_checkCounter(rate)) channel[ch].gain = newGain;
+		if(dsp_checkCounter(rate)) voice.gain[ch] = newGain;
 	}
 
-	int16_t Dsp::dsp_getSample(int ch) {
-		int pos = (channel[ch].pitchCounter >> 12) + channel[ch].bufferOffset;
-		int offset = (channel[ch].pitchCounter >> 4) & 0xff;
-		int16_t news = channel[ch].decodeBuffer[(pos + 3) % 12];
-		int16_t olds = channel[ch].decodeBuffer[(pos + 2) % 12];
-		int16_t olders = channel[ch].decodeBuffer[(pos + 1) % 12];
-		int16_t oldests = channel[ch].decodeBuffer[pos % 12];
-		int out = (gaussValues[0xff - offset] * oldests) >> 11;
-		out += (gaussValues[0x1ff - offset] * olders) >> 11;
-		out += (gaussValues[0x100 + offset] * olds) >> 11;
-		out = clip16(out) + ((gaussValues[offset] * news) >> 11);
-		return clamp16(out) & ~1;
+	void Dsp::dsp_decodeBrr(int ch) {
+		int bOff = voice.bufferOffset[ch];
+		int16_t* buf = voice.decodeBuffer[ch];
+		int old = buf[bOff + 11] >> 1;
+		int older = buf[bOff + 10] >> 1;
+		DspBrrCacheEntry* entry = dsp_lookupBrrBlock(ch, old, older);
+		if(entry) {
+			memcpy(&buf[bOff], &entry->samples[channel[ch].blockOffset >> 1 << 2], 4 * sizeof(int16_t));
+		} else {
+			decodeBrrSamples(config.apu->ram, channel[ch].decodeOffset + channel[ch].blockOffset, channel[ch].brrHeader, old, older, &buf[bOff], 4);
+		}
+		memcpy(&buf[bOff + 12], &buf[bOff], 4 * sizeof(int16_t));
+		voice.bufferOffset[ch] += 4;
+		if(voice.bufferOffset[ch] >= 12) voice.bufferOffset[ch] = 0;
 	}
 
-	void Dsp::dsp_decodeBrr(int ch) {
-		int shift = channel[ch].brrHeader >> 4;
-		int filter = (channel[ch].brrHeader & 0xc) >> 2;
-		int bOff = channel[ch].bufferOffset;
-		int old = channel[ch].decodeBuffer[bOff == 0 ? 11 : bOff - 1] >> 1;
-		int older = channel[ch].decodeBuffer[bOff == 0 ? 10 : bOff - 2] >> 1;
-		uint8_t curByte = 0;
-		for(int i = 0; i < 4; i++) {
-			int s = 0;
-			if(i & 1) {
-				s = curByte & 0xf;
-			} else {
-				curByte = config.apu->ram[(channel[ch].decodeOffset + channel[ch].blockOffset + (i >> 1)) & 0xffff];
-				s = curByte >> 4;
-			}
-			if(s > 7) s -= 16;
-			if(shift <= 0xc) {
-				s = (s << shift) >> 1;
-			} else {
-				s = (s >> 3) << 12;
-			}
-			switch(filter) {
-				case 1: s += old + (-old >> 4); break;
-				case 2: s += 2 * old + ((3 * -old) >> 5) - older + (older >> 4); break;
-				case 3: s += 2 * old + ((13 * -old) >> 6) - older + ((3 * older) >> 4); break;
-			}
-			channel[ch].decodeBuffer[bOff + i] = clamp16(s) * 2; // cuts off bit 15
-			older = old;
-			old = channel[ch].decodeBuffer[bOff + i] >> 1;
+	DspBrrCacheEntry* Dsp::dsp_lookupBrrBlock(int ch, int old, int older) {
+		DspChannel& c = channel[ch];
+		// only the 4 regular steps of a block use the cache (blockOffset is only even after a reset)
+		if((c.blockOffset & 1) == 0) {
+			brrCacheMisses++;
+			return NULL;
+		}
+		int filter = (c.brrHeader & 0xc) >> 2;
+		if(filter == 0) old = 0;
+		if(filter <= 1) older = 0;
+		uint16_t adr = c.decodeOffset;
+		int g0 = adr >> 4;
+		int g1 = ((adr + 8) & 0xffff) >> 4;
+		if(c.blockOffset > 1) {
+			// later steps continue with the entry used for the start of the block, as long as
+			// neither the block nor the history coming out of the previous step changed
+			if(!c.brrCached) {
+				brrCacheMisses++;
+				return NULL;
+			}
+			DspBrrCacheEntry* entry = &brrCache[c.brrCacheSlot];
+			int prev = (c.blockOffset >> 1 << 2) - 1;
+			if(
+				!entry->valid || entry->adr != adr || entry->header != c.brrHeader ||
+				entry->generation[0] != brrGeneration[g0] || entry->generation[1] != brrGeneration[g1] ||
+				(filter != 0 && old != entry->samples[prev] >> 1) || (filter > 1 && older != entry->samples[prev - 1] >> 1)
+			) {
+				c.brrCached = false;
+				brrCacheMisses++;
+				return NULL;
+			}
+			brrCacheHits++;
+			return entry;
+		}
+		// start of a block: find or fill its entry
+		uint16_t slot = (adr ^ (adr >> 10) ^ (c.brrHeader << 2) ^ old ^ (older << 3)) & 0x3ff;
+		DspBrrCacheEntry* entry = &brrCache[slot];
+		c.brrCacheSlot = slot;
+		c.brrCached = true;
+		if(
+			entry->valid && entry->adr == adr && entry->header == c.brrHeader && entry->old == old && entry->older == older &&
+			entry->generation[0] == brrGeneration[g0] && entry->generation[1] == brrGeneration[g1]
+		) {
+			brrCacheHits++;
+			return entry;
 		}
-		channel[ch].bufferOffset += 4;
-		if(channel[ch].bufferOffset >= 12) channel[ch].bufferOffset = 0;
+		// decode the whole block into the entry; this step still counts as a miss
+		brrCacheMisses++;
+		entry->valid = true;
+		entry->adr = adr;
+		entry->header = c.brrHeader;
+		entry->old = old;
+		entry->older = older;
+		entry->generation[0] = brrGeneration[g0];
+		entry->generation[1] = brrGeneration[g1];
+		decodeBrrSamples(config.apu->ram, adr + 1, c.brrHeader, old, older, entry->samples, 16);
+		return entry;
 	}
 
 	void Dsp::dsp_handleNoise() {
@@ -417,19 +668,19 @@ namespace LakeSnes
 		int ch = adr >> 4;
 		switch(adr) {
 			case 0x00: case 0x10: case 0x20: case 0x30: case 0x40: case 0x50: case 0x60: case 0x70: {
-				channel[ch].volumeL = val;
+				voice.volumeL[ch] = (int8_t) val;
 				break;
 			}
 			case 0x01: case 0x11: case 0x21: case 0x31: case 0x41: case 0x51: case 0x61: case 0x71: {
-				channel[ch].volumeR = val;
+				voice.volumeR[ch] = (int8_t) val;
 				break;
 			}
 			case 0x02: case 0x12: case 0x22: case 0x32: case 0x42: case 0x52: case 0x62: case 0x72: {
-				channel[ch].pitch = (channel[ch].pitch & 0x3f00) | val;
+				voice.pitch[ch] = (voice.pitch[ch] & 0x3f00) | val;
 				break;
 			}
 			case 0x03: case 0x13: case 0x23: case 0x33: case 0x43: case 0x53: case 0x63: case 0x73: {
-				channel[ch].pitch = ((channel[ch].pitch & 0x00ff) | (val << 8)) & 0x3fff;
+				voice.pitch[ch] = ((voice.pitch[ch] & 0x00ff) | (val << 8)) & 0x3fff;
 				break;
 			}
 			case 0x04: case 0x14: case 0x24: case 0x34: case 0x44: case 0x54: case 0x64: case 0x74: {
@@ -506,13 +757,13 @@ namespace LakeSnes
 			}
 			case 0x3d: {
 				for(int i = 0; i < 8; i++) {
-					channel[i].useNoise = val & (1 << i);
+					voice.useNoise[i] = val & (1 << i);
 				}
 				break;
 			}
 			case 0x4d: {
 				for(int i = 0; i < 8; i++) {
-					channel[i].echoEnable = val & (1 << i);
+					voice.echoEnable[i] = val & (1 << i);
 				}
 				break;
 			}
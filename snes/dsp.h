@@ -2,25 +2,54 @@
 
 #include <stdint.h>
 
+#include "audiosink.h"
+
 namespace LakeSnes
 {
 	class Apu;
 	class Snes;
+	class AudioStream;
+
+	// per-voice state touched by every voice on every sample, kept as one array per field
+	// so the interpolation, envelope multiply and volume stages run as straight 8-lane loops
+	struct DspVoices
+	{
+		uint16_t pitch[8];
+		uint16_t pitchCounter[8];
+		uint16_t gain[8];
+		int16_t sampleOut[8]; // final sample, to be multiplied by channel volume
+		int16_t volumeL[8];
+		int16_t volumeR[8];
+		uint8_t bufferOffset[8];
+		bool useNoise[8];
+		bool echoEnable[8];
+		// decoded brr samples, entries 0-11 are mirrored at 12-23 so interpolation never wraps
+		int16_t decodeBuffer[8][24];
+	};
+
+	// 16 decoded samples of one brr block, for one header and incoming filter history
+	struct DspBrrCacheEntry
+	{
+		uint16_t adr; // address of the block header
+		uint8_t header;
+		bool valid;
+		int16_t old; // filter history the block was decoded with (zeroed where the filter ignores it)
+		int16_t older;
+		uint32_t generation[2]; // write generations of the aram granules holding the block
+		int16_t samples[16];
+	};
 
 	struct DspChannel
 	{
 		// pitch
-		uint16_t pitch;
-		uint16_t pitchCounter;
 		bool pitchModulation;
 		// brr decoding
-		int16_t decodeBuffer[12];
-		uint8_t bufferOffset;
 		uint8_t srcn;
 		uint16_t decodeOffset;
 		uint8_t blockOffset; // offset within brr block
 		uint8_t brrHeader;
-		bool useNoise;
+		uint16_t brrCacheSlot; // cache entry backing the current block, if brrCached
+		bool brrCached;
 		uint8_t startDelay;
 		// adsr, envelope, gain
 		uint8_t adsrRates[4]; // attack, decay, sustain, gain
@@ -32,15 +61,9 @@ namespace LakeSnes
 		bool directGain;
 		uint16_t gainValue; // for direct gain
 		uint16_t preclampGain; // for bent increase
-		uint16_t gain;
 		// keyon/off
 		bool keyOn;
 		bool keyOff;
-		// output
-		int16_t sampleOut; // final sample, to be multiplied by channel volume
-		int8_t volumeL;
-		int8_t volumeR;
-		bool echoEnable;
 	};
 
 	class Dsp
@@ -54,17 +77,24 @@ namespace LakeSnes
 		void dsp_write(uint8_t adr, uint8_t val);
 		void dsp_getSamples(int16_t* sampleData, int samplesPerFrame);
 		void dsp_newFrame();
+		void dsp_flushBrrCache();
+		void dsp_flushCapture();
+		// called for every write to aram, so cached brr blocks covering it are dropped
+		void dsp_ramWritten(uint16_t adr) { brrGeneration[adr >> 4]++; }
 
 	private:
 		bool dsp_checkCounter(int rate);
-		void dsp_cycleChannel(int ch);
+		bool dsp_startChannel(int ch, uint16_t* sampleAdr);
+		void dsp_interpolate();
+		void dsp_updateChannel(int ch, uint16_t sampleAdr, bool starting);
+		void dsp_mixVoices();
 		void dsp_handleEcho();
 		void dsp_handleGain(int ch);
 		void dsp_decodeBrr(int ch);
-		int16_t dsp_getSample(int ch);
+		DspBrrCacheEntry* dsp_lookupBrrBlock(int ch, int old, int older);
 		void dsp_handleNoise();
 
-	private:
+	public:
 
 		struct
 		{
@@ -73,11 +103,11 @@ namespace LakeSnes
 		} config;
 
 		//MEMBERS:
-	public:
 		// mirror ram
 		uint8_t ram[0x80];
 		// 8 channels
 		DspChannel channel[8];
+		DspVoices voice;
 		// overarching
 		uint16_t counter;
 		uint16_t dirPage;
@@ -105,12 +135,24 @@ namespace LakeSnes
 		uint16_t echoBufferIndex;
 		uint8_t firBufferIndex;
 		int8_t firValues[8];
-		int16_t firBufferL[8];
-		int16_t firBufferR[8];
+		int16_t firBufferL[16]; // history is written twice (index and index + 8) so the taps read it linearly
+		int16_t firBufferR[16];
 		// sample ring buffer (2048 samples, *2 for stereo)
 		uint16_t sampleOffset; // current offset in samplebuffer
 		uint32_t lastFrameBoundary;
 		int16_t sampleBuffer[0x800 * 2];
+		// streaming output, if opened (see Snes::snes_openAudioStream)
+		AudioStream* audioStream;
+		// capture sink, if set (see Snes::snes_setAudioSink), and the batch collected for it
+		AudioSink captureSink;
+		void* captureUserdata;
+		int captureCount;
+		int16_t captureBuffer[0x400 * 2];
+		// decoded brr block cache, direct mapped
+		DspBrrCacheEntry brrCache[0x400];
+		uint32_t brrGeneration[0x1000]; // per 16-byte aram granule, bumped on every write
+		uint64_t brrCacheHits; // counted per 4-sample decode step
+		uint64_t brrCacheMisses;
 
 
 	};
@@ -1,5 +1,7 @@
 #include "ppu.h"
 #include "snes.h"
+#include "conf.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,14 +68,10 @@ namespace LakeSnes
 
 	// caches & luts to reduce cpu load
 	static uint32_t bright_lut[0x10];
-	static uint32_t bright_now;
 	static uint8_t color_clamp_lut[0x20 * 3];
 	static uint8_t *color_clamp_lut_i20 = &color_clamp_lut[0x20];
-
-	static int layerCache[4] = { -1, -1, -1, -1 };
-	static uint16_t bg_pixel_buf[4];
-	static uint8_t bg_prio_buf[4];
-	static bool bg_window_state[6]; // 0-3 (bg) 4 (spr) 5 (colorwind)
+	// one bitplane byte spread out to a nibble per pixel (leftmost pixel in the low nibble)
+	static uint32_t planar_lut[0x100];
 
 	static void ppu_handlePixel(int x, int y);
 	static int ppu_getPixel(int x, int y, bool sub, int* r, int* g, int* b);
@@ -88,7 +86,18 @@ namespace LakeSnes
 
 	void Ppu::ppu_init(Snes* snes) {
 		config.snes = snes;
-		config.pixelBuffer =  snes->snesConfig.pixelBufferRGBX8888_512x239x2;
+		const SnesConfig& snesConfig = snes->snesConfig;
+		config.pixelBuffer = snesConfig.pixelBuffer;
+		config.pixelFormat = snesConfig.pixelFormat;
+		config.pixelHires = snesConfig.pixelHires;
+		if(config.pixelBuffer == NULL) {
+			config.pixelBuffer = snesConfig.pixelBufferRGBX8888_512x239x2;
+			config.pixelFormat = PixelFormat::XRGB8888;
+			config.pixelHires = true;
+		}
+		int bytesPerPixel = config.pixelFormat == PixelFormat::XRGB8888 ? 4 : (config.pixelFormat == PixelFormat::Indexed ? 1 : 2);
+		config.pixelPitch = snesConfig.pixelPitch;
+		if(config.pixelPitch == 0 || snesConfig.pixelBuffer == NULL) config.pixelPitch = bytesPerPixel * (config.pixelHires ? 512 : 256);
 	}
 
 	void Ppu::ppu_free() {
@@ -110,9 +119,24 @@ namespace LakeSnes
 				color_clamp_lut[i] = 0x1f;
 			}
 		}
-		bright_now = bright_lut[0xf]; // default
+		paletteBright = bright_lut[0xf]; // default
+		for (int i = 0; i < 0x100; i++) {
+			planar_lut[i] = 0;
+			for (int px = 0; px < 8; px++) {
+				planar_lut[i] |= ((i >> (7 - px)) & 1) << (px * 4);
+			}
+		}
 
 		memset(vram, 0, sizeof(vram));
+		vramGeneration = 0;
+		cgramGeneration = 0;
+		oamGeneration = 0;
+		memset(lineSignature, 0, sizeof(lineSignature));
+		memset(linesChanged, 0xff, sizeof(linesChanged));
+		memset(frameLinesChanged, 0xff, sizeof(frameLinesChanged));
+		frameUnchanged = false;
+		lastFrameOverscan = false;
+		lastFrameInterlace = false;
 		vramPointer = 0;
 		vramIncrementOnHigh = false;
 		vramIncrement = 1;
@@ -135,10 +159,12 @@ namespace LakeSnes
 		objTileAdr2 = 0;
 		objSize = 0;
 		memset(objPixelBuffer, 0, sizeof(objPixelBuffer));
+		memset(sliverCache, 0xff, sizeof(sliverCache)); // -1, nothing decoded
 		memset(objPriorityBuffer, 0, sizeof(objPriorityBuffer));
 		timeOver = false;
 		rangeOver = false;
 		objInterlace = false;
+		objCacheDirty = true;
 		for(int i = 0; i < 4; i++) {
 			bgLayer[i].hScroll = 0;
 			bgLayer[i].vScroll = 0;
@@ -206,6 +232,7 @@ namespace LakeSnes
 		countersLatched = false;
 		ppu1openBus = 0;
 		ppu2openBus = 0;
+		ppu_updatePalette(0, 0x100);
 	}
 
 	bool Ppu::ppu_checkOverscan() {
@@ -222,6 +249,80 @@ namespace LakeSnes
 			oamSecondWrite = false;
 		}
 		frameInterlace = interlace; // set if we have a interlaced frame
+		ppu_latchChanges();
+		if(frameSlots[0] != NULL) ppu_publishFrame();
+	}
+
+	void Ppu::ppu_setFrameSlots(uint8_t* slots[3]) {
+		// only while the emulation and consumer threads are both stopped
+		if(slots == NULL) {
+			frameSlots[0] = frameSlots[1] = frameSlots[2] = NULL;
+			ppu_init(config.snes);
+			return;
+		}
+		for(int i = 0; i < 3; i++) frameSlots[i] = slots[i];
+		frameSlotBack = 0;
+		frameSlotFront = 1;
+		frameSlotShared.store(2);
+		config.pixelBuffer = frameSlots[frameSlotBack];
+	}
+
+	void Ppu::ppu_publishFrame() {
+		// called at the start of vblank, all visible lines are in the back slot
+		GetFramebufferInfo(&frameSlotInfo[frameSlotBack]);
+		frameSlotSequence[frameSlotBack] = ++frameSequence;
+		int previous = frameSlotShared.exchange(frameSlotBack | frameSlotFresh, std::memory_order_acq_rel);
+		frameSlotBack = previous & 3;
+		config.pixelBuffer = frameSlots[frameSlotBack];
+	}
+
+	const uint8_t* Ppu::ppu_acquireFrame(Ppu::FramebufferInfo* info, uint64_t* sequence) {
+		if(frameSlots[0] == NULL || !(frameSlotShared.load(std::memory_order_relaxed) & frameSlotFresh)) return NULL;
+		int previous = frameSlotShared.exchange(frameSlotFront, std::memory_order_acq_rel);
+		frameSlotFront = previous & 3;
+		if(info != NULL) *info = frameSlotInfo[frameSlotFront];
+		if(sequence != NULL) *sequence = frameSlotSequence[frameSlotFront];
+		return frameSlots[frameSlotFront];
+	}
+
+	uint64_t Ppu::ppu_lineSignature() {
+		// everything besides the line number that the line's pixels depend on, vram, cgram and oam by generation
+		uint64_t words[] = {
+			vramGeneration | (uint64_t) cgramGeneration << 32,
+			oamGeneration | (uint64_t) rawINIDISP << 32 | (uint64_t) rawOBSEL << 40 | (uint64_t) rawBGMODE << 48 | (uint64_t) rawMosaic << 56,
+			0, 0, 0, 0, // bg layers
+			(uint64_t) (uint16_t) m7matrix[0] | (uint64_t) (uint16_t) m7matrix[1] << 16 | (uint64_t) (uint16_t) m7matrix[2] << 32 | (uint64_t) (uint16_t) m7matrix[3] << 48,
+			(uint64_t) (uint16_t) m7matrix[4] | (uint64_t) (uint16_t) m7matrix[5] << 16 | (uint64_t) (uint16_t) m7matrix[6] << 32 | (uint64_t) (uint16_t) m7matrix[7] << 48,
+			window1left | window1right << 8 | window2left << 16 | (uint64_t) window2right << 24 | (uint64_t) rawWindowSelect[0] << 32 |
+				(uint64_t) rawWindowSelect[1] << 40 | (uint64_t) rawWindowSelect[2] << 48 | (uint64_t) rawWindowMask[0] << 56,
+			rawWindowMask[1] | rawWindowEnable[0] << 8 | rawWindowEnable[1] << 16 | (uint64_t) rawScreenDesignation[0] << 24 |
+				(uint64_t) rawScreenDesignation[1] << 32 | (uint64_t) rawCGWSEL << 40 | (uint64_t) rawCGADSUB << 48 | (uint64_t) rawSETINI << 56,
+			fixedColorR | fixedColorG << 8 | fixedColorB << 16 | m7largeField << 24 | m7charFill << 25 | m7xFlip << 26 | m7yFlip << 27 |
+				(uint64_t) mosaicStartLine << 32 | (uint64_t) (objPriority ? 0x100 | oamAdr : 0) << 40 | (uint64_t) ((interlace || objInterlace) && !evenFrame) << 52
+		};
+		for(int i = 0; i < 4; i++) {
+			const BgLayer& bg = bgLayer[i];
+			words[2 + i] = bg.hScroll | bg.vScroll << 16 | (uint64_t) (bg.tilemapAdr | bg.tilemapWider | bg.tilemapHigher << 1) << 32 | (uint64_t) bg.tileAdr << 48;
+		}
+		uint64_t hash = 0;
+		for(uint64_t word : words) {
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 32;
+		}
+		return hash;
+	}
+
+	void Ppu::ppu_latchChanges() {
+		// called at the start of vblank, when all lines of the frame are rendered
+		bool sameLayout = frameOverscan == lastFrameOverscan && frameInterlace == lastFrameInterlace && !frameInterlace;
+		frameUnchanged = sameLayout;
+		for(int i = 0; i < 4; i++) {
+			frameLinesChanged[i] = sameLayout ? linesChanged[i] : ~0ull;
+			if(frameLinesChanged[i] != 0) frameUnchanged = false;
+			linesChanged[i] = 0;
+		}
+		lastFrameOverscan = frameOverscan;
+		lastFrameInterlace = frameInterlace;
 	}
 
 	void Ppu::ppu_handleFrameStart() {
@@ -233,6 +334,16 @@ namespace LakeSnes
 	}
 
 	void Ppu::ppu_runLine(int line) {
+		LAKESNES_TIMELINE_SCOPE(config.snes, "ppu_runLine");
+		// compare against the previous frame's line
+		uint64_t signature = ppu_lineSignature();
+		LAKESNES_STAT(config.snes, ppuLines, 1);
+		if(signature != lineSignature[line - 1]) {
+			lineSignature[line - 1] = signature;
+			linesChanged[(line - 1) >> 6] |= 1ull << ((line - 1) & 63);
+		} else {
+			LAKESNES_STAT(config.snes, ppuLinesUnchanged, 1);
+		}
 		#ifdef LAKESNES_EXPERIMENTAL_PPU
 		ExperimentalRunLine(this,line);
 		return;
@@ -242,8 +353,13 @@ namespace LakeSnes
 		memset(objPixelBuffer, 0, sizeof(objPixelBuffer));
 		if(!forcedBlank) ppu_evaluateSprites(line - 1);
 		// actual line
-		if(mode == 7) ppu_calculateMode7Starts(line);
-		layerCache[0] = layerCache[1] = layerCache[2] = layerCache[3] = -1;
+		if(mode == 7) {
+			ppu_calculateMode7Starts(line);
+			ppu_renderMode7Line();
+		}
+		sliverCache[0] = sliverCache[1] = sliverCache[2] = sliverCache[3] = -1;
+		if(mode == 2 || mode == 4 || mode == 6) ppu_fetchOffsets();
+		linePixels = &config.pixelBuffer[((line - 1) * 2 + (evenFrame ? 0 : 1)) * config.pixelPitch];
 		for(int x = 0; x < 256; x+=4) {
 			ppu_handlePixel(x + 0, line);
 			ppu_handlePixel(x + 1, line);
@@ -258,16 +374,19 @@ namespace LakeSnes
 		int g = 0, g2 = 0;
 		int b = 0, b2 = 0;
 		bool halfColor = this->halfColor;
+		bool hires = pseudoHires || mode == 5 || mode == 6;
+		bool plain = false; // both colors straight from cgram, no clipping or math: output from the palette
 		// cache for speed-up
-		bg_window_state[0] = ppu_getWindowState(0, x);
-		bg_window_state[1] = ppu_getWindowState(1, x);
-		bg_window_state[2] = ppu_getWindowState(2, x);
-		bg_window_state[3] = ppu_getWindowState(3, x);
-		bg_window_state[4] = ppu_getWindowState(4, x);
-		bg_window_state[5] = ppu_getWindowState(5, x);
+		bgWindowState[0] = ppu_getWindowState(0, x);
+		bgWindowState[1] = ppu_getWindowState(1, x);
+		bgWindowState[2] = ppu_getWindowState(2, x);
+		bgWindowState[3] = ppu_getWindowState(3, x);
+		bgWindowState[4] = ppu_getWindowState(4, x);
+		bgWindowState[5] = ppu_getWindowState(5, x);
 		if(!forcedBlank) {
 			int mainLayer = ppu_getPixel(x, y, false, &r, &g, &b);
-			bool colorWindowState = bg_window_state[5];
+			plain = !directColor; // direct color pixels don't come from cgram
+			bool colorWindowState = bgWindowState[5];
 			if(
 				clipMode == 3 ||
 				(clipMode == 2 && colorWindowState) ||
@@ -277,6 +396,7 @@ namespace LakeSnes
 				r = 0;
 				g = 0;
 				b = 0;
+				plain = false;
 			}
 			int secondLayer = 5; // backdrop
 			bool mathEnabled = mainLayer < 6 && this->mathEnabled[mainLayer] && !(
@@ -284,12 +404,13 @@ namespace LakeSnes
 				(preventMathMode == 2 && colorWindowState) ||
 				(preventMathMode == 1 && !colorWindowState)
 			);
-			if((mathEnabled && addSubscreen) || pseudoHires || mode == 5 || mode == 6) {
+			if((mathEnabled && addSubscreen) || (hires && config.pixelHires)) {
 				secondLayer = ppu_getPixel(x, y, true, &r2, &g2, &b2);
 			}
 			// TODO: subscreen pixels can be clipped to black as well
 			// TODO: math for subscreen pixels (add/sub sub to main, in hires mode)
 			if(mathEnabled) {
+				plain = false;
 				if(subtractColor) {
 					if (addSubscreen && secondLayer != 5) {
 						r -= r2;
@@ -320,19 +441,95 @@ namespace LakeSnes
 				g = color_clamp_lut_i20[g];
 				b = color_clamp_lut_i20[b];
 			}
-			if(!(pseudoHires || mode == 5 || mode == 6)) {
+			if(!hires) {
 				r2 = r; g2 = g; b2 = b;
 			}
 		}
-		uint32_t *dest = (uint32_t*)&config.pixelBuffer[((y - 1) + (evenFrame ? 0 : 239)) * 2048 + x * 8];
+		// the even (sub screen) column only exists in 512 wide output
+		switch(config.pixelFormat) {
+			case PixelFormat::XRGB8888: {
+				uint32_t* dest = (uint32_t*)linePixels;
+				if(plain) {
+					uint32_t color = paletteOut[pixelIndex[0]];
+					if(config.pixelHires) {
+						dest[x * 2] = hires ? paletteOut[pixelIndex[1]] : color;
+						dest[x * 2 + 1] = color;
+					} else {
+						dest[x] = color;
+					}
+					break;
+				}
+				uint32_t color = ppu_packColor(r, g, b);
+				if(config.pixelHires) {
+					dest[x * 2] = ppu_packColor(r2, g2, b2);
+					dest[x * 2 + 1] = color;
+				} else {
+					dest[x] = color;
+				}
+			} break;
+			case PixelFormat::RGB565:
+			case PixelFormat::BGR555: {
+				uint16_t* dest = (uint16_t*)linePixels;
+				if(plain) {
+					uint16_t color = paletteOut[pixelIndex[0]];
+					if(config.pixelHires) {
+						dest[x * 2] = hires ? paletteOut[pixelIndex[1]] : color;
+						dest[x * 2 + 1] = color;
+					} else {
+						dest[x] = color;
+					}
+					break;
+				}
+				bool rgb565 = config.pixelFormat == PixelFormat::RGB565;
+				uint16_t color = ppu_packColor16(r, g, b, rgb565);
+				if(config.pixelHires) {
+					dest[x * 2] = ppu_packColor16(r2, g2, b2, rgb565);
+					dest[x * 2 + 1] = color;
+				} else {
+					dest[x] = color;
+				}
+			} break;
+			case PixelFormat::Indexed: {
+				uint8_t index = forcedBlank ? 0 : pixelIndex[0];
+				if(config.pixelHires) {
+					linePixels[x * 2] = forcedBlank ? 0 : (hires ? pixelIndex[1] : index);
+					linePixels[x * 2 + 1] = index;
+				} else {
+					linePixels[x] = index;
+				}
+			} break;
+		}
+	}
 
-		dest[0] = ((((b2 << 3) | (b2 >> 2)) * bright_now) >> 16) << 0 |
-							((((g2 << 3) | (g2 >> 2)) * bright_now) >> 16) << 8 |
-							((((r2 << 3) | (r2 >> 2)) * bright_now) >> 16) << 16;
+	void Ppu::ppu_updatePalette(int first, int count) {
+		// called when cgram entries or the brightness change
+		for(int i = first; i < first + count; i++) {
+			uint16_t color = cgram[i & 0xff];
+			int r = color & 0x1f;
+			int g = (color >> 5) & 0x1f;
+			int b = (color >> 10) & 0x1f;
+			if(config.pixelFormat == PixelFormat::XRGB8888) {
+				paletteOut[i & 0xff] = ppu_packColor(r, g, b);
+			} else if(config.pixelFormat != PixelFormat::Indexed) {
+				paletteOut[i & 0xff] = ppu_packColor16(r, g, b, config.pixelFormat == PixelFormat::RGB565);
+			}
+		}
+	}
 
-		dest[1] = ((((b << 3) | (b >> 2)) * bright_now) >> 16) << 0 |
-							((((g << 3) | (g >> 2)) * bright_now) >> 16) << 8 |
-							((((r << 3) | (r >> 2)) * bright_now) >> 16) << 16;
+	uint32_t Ppu::ppu_packColor(int r, int g, int b) {
+		// apply brightness, expanding to 8 bits per channel
+		return ((((b << 3) | (b >> 2)) * paletteBright) >> 16) << 0 |
+					 ((((g << 3) | (g >> 2)) * paletteBright) >> 16) << 8 |
+					 ((((r << 3) | (r >> 2)) * paletteBright) >> 16) << 16;
+	}
+
+	uint16_t Ppu::ppu_packColor16(int r, int g, int b, bool rgb565) {
+		uint32_t color = ppu_packColor(r, g, b);
+		int r8 = (color >> 16) & 0xff;
+		int g8 = (color >> 8) & 0xff;
+		int b8 = color & 0xff;
+		if(rgb565) return ((r8 >> 3) << 11) | ((g8 >> 2) << 5) | (b8 >> 3);
+		return ((b8 >> 3) << 10) | ((g8 >> 3) << 5) | (r8 >> 3);
 	}
 
 	int Ppu::ppu_getPixel(int x, int y, bool sub, int* r, int* g, int* b) {
@@ -348,11 +545,11 @@ namespace LakeSnes
 			bool layerActive = false;
 			if(!sub) {
 				layerActive = this->layer[curLayer].mainScreenEnabled && (
-					!this->layer[curLayer].mainScreenWindowed || !bg_window_state[curLayer]
+					!this->layer[curLayer].mainScreenWindowed || !bgWindowState[curLayer]
 				);
 			} else {
 				layerActive = this->layer[curLayer].subScreenEnabled && (
-					!this->layer[curLayer].subScreenWindowed || !bg_window_state[curLayer]
+					!this->layer[curLayer].subScreenWindowed || !bgWindowState[curLayer]
 				);
 			}
 			if(layerActive) {
@@ -380,11 +577,8 @@ namespace LakeSnes
 						if(mode == 2 || mode == 4 || mode == 6) {
 							ppu_handleOPT(curLayer, &lx, &ly);
 						}
-						if (lx != layerCache[curLayer]) {
-							ppu_getPixelForBgLayer(lx & 0x3ff, ly & 0x3ff, curLayer);
-							layerCache[curLayer] = lx;
-						}
-						pixel = (bg_prio_buf[curLayer] == curPriority) ? bg_pixel_buf[curLayer] : 0;
+						ppu_getPixelForBgLayer(lx & 0x3ff, ly & 0x3ff, curLayer);
+						pixel = (bgPrioBuf[curLayer] == curPriority) ? bgPixelBuf[curLayer] : 0;
 					}
 				} else {
 					// get a pixel from the sprite buffer
@@ -402,6 +596,7 @@ namespace LakeSnes
 			*g = ((pixel & 0x38) >> 1) | ((pixel & 0x200) >> 8);
 			*b = ((pixel & 0xc0) >> 3) | ((pixel & 0x400) >> 8);
 		} else {
+			pixelIndex[sub] = pixel & 0xff;
 			uint16_t color = cgram[pixel & 0xff];
 			*r = color & 0x1f;
 			*g = (color >> 5) & 0x1f;
@@ -423,7 +618,7 @@ namespace LakeSnes
 		if(column > 0) {
 			// fetch offset values from layer 3 tilemap
 			int valid = layer == 0 ? 0x2000 : 0x4000;
-			uint16_t hOffset = ppu_getOffsetValue(column - 1, 0);
+			uint16_t hOffset = column <= 64 ? optOffsets[0][column - 1] : ppu_getOffsetValue(column - 1, 0);
 			uint16_t vOffset = 0;
 			if(mode == 4) {
 				if(hOffset & 0x8000) {
@@ -431,7 +626,7 @@ namespace LakeSnes
 					hOffset = 0;
 				}
 			} else {
-				vOffset = ppu_getOffsetValue(column - 1, 1);
+				vOffset = column <= 64 ? optOffsets[1][column - 1] : ppu_getOffsetValue(column - 1, 1);
 			}
 			if(mode == 6) {
 				// TODO: not sure if correct
@@ -444,6 +639,14 @@ namespace LakeSnes
 		}
 	}
 
+	void Ppu::ppu_fetchOffsets() {
+		// the offsets only depend on the column, so read them once per line instead of per pixel
+		for(int col = 0; col < 64; col++) {
+			optOffsets[0][col] = ppu_getOffsetValue(col, 0);
+			if(mode != 4) optOffsets[1][col] = ppu_getOffsetValue(col, 1);
+		}
+	}
+
 	uint16_t Ppu::ppu_getOffsetValue(int col, int row) {
 		int x = col * 8 + bgLayer[2].hScroll;
 		int y = row * 8 + bgLayer[2].vScroll;
@@ -456,6 +659,16 @@ namespace LakeSnes
 	}
 
 	void Ppu::ppu_getPixelForBgLayer(int x, int y, int layer) {
+		int key = (y << 10) | (x & ~7);
+		if(key != sliverCache[layer]) {
+			ppu_decodeBgSliver(x, y, layer);
+			sliverCache[layer] = key;
+		}
+		bgPixelBuf[layer] = sliverPixels[layer][x & 7];
+		bgPrioBuf[layer] = sliverPrio[layer];
+	}
+
+	void Ppu::ppu_decodeBgSliver(int x, int y, int layer) {
 		// figure out address of tilemap word and read it
 		bool wideTiles = bgLayer[layer].bigTiles || mode == 5 || mode == 6;
 		int tileBitsX = wideTiles ? 4 : 3;
@@ -467,11 +680,10 @@ namespace LakeSnes
 		if((y & tileHighBitY) && bgLayer[layer].tilemapHigher) tilemapAdr += bgLayer[layer].tilemapWider ? 0x800 : 0x400;
 		uint16_t tile = vram[tilemapAdr & 0x7fff];
 		// check priority, get palette
-		int tilePrio = (tile >> 13) & 1;
+		sliverPrio[layer] = (tile >> 13) & 1;
 		int paletteNum = (tile & 0x1c00) >> 10;
-		// figure out position within tile
+		// figure out row within tile
 		int row = (tile & 0x8000) ? 7 - (y & 0x7) : (y & 0x7);
-		int col = (tile & 0x4000) ? (x & 0x7) : 7 - (x & 0x7);
 		int tileNum = tile & 0x3ff;
 		if(wideTiles) {
 			// if unflipped right half of tile, or flipped left half of tile
@@ -484,46 +696,33 @@ namespace LakeSnes
 		// read tiledata, ajust palette for mode 0
 		int bitDepth = bitDepthsPerMode[mode][layer];
 		if(mode == 0) paletteNum += 8 * layer;
-		// plane 1 (always)
 		const uint16_t base_addr = bgLayer[layer].tileAdr + ((tileNum & 0x3ff) * 4 * bitDepth);
-		const int bit2shift = 8 + col;
-		int pixel = 0;
+		// spread the planes out to a nibble per pixel: planes 0-3 in low, 4-7 in high
+		uint32_t low = 0;
+		uint32_t high = 0;
 		switch (bitDepth) {
-			case 2: {
-					uint16_t plane = vram[(base_addr + row) & 0x7fff];
-					pixel = (plane >> col) & 1;
-					pixel |= ((plane >> bit2shift) & 1) << 1;
-			} break;
-			case 4: {
-					uint16_t plane = vram[(base_addr + row) & 0x7fff];
-					pixel = (plane >> col) & 1;
-					pixel |= ((plane >> bit2shift) & 1) << 1;
-
-					plane = vram[(base_addr + 8 + row) & 0x7fff];
-					pixel |= ((plane >> col) & 1) << 2;
-					pixel |= ((plane >> bit2shift) & 1) << 3;
-			} break;
 			case 8: {
-					uint16_t plane = vram[(base_addr + row) & 0x7fff];
-					pixel = (plane >> col) & 1;
-					pixel |= ((plane >> bit2shift) & 1) << 1;
-
-					plane = vram[(base_addr + 8 + row) & 0x7fff];
-					pixel |= ((plane >> col) & 1) << 2;
-					pixel |= ((plane >> bit2shift) & 1) << 3;
-
-					plane = vram[(base_addr + 16 + row) & 0x7fff];
-					pixel |= ((plane >> col) & 1) << 4;
-					pixel |= ((plane >> bit2shift) & 1) << 5;
-
+					uint16_t plane = vram[(base_addr + 16 + row) & 0x7fff];
+					high = planar_lut[plane & 0xff] | (planar_lut[plane >> 8] << 1);
 					plane = vram[(base_addr + 24 + row) & 0x7fff];
-					pixel |= ((plane >> col) & 1) << 6;
-					pixel |= ((plane >> bit2shift) & 1) << 7;
+					high |= (planar_lut[plane & 0xff] << 2) | (planar_lut[plane >> 8] << 3);
+			} // fall through
+			case 4: {
+					uint16_t plane = vram[(base_addr + 8 + row) & 0x7fff];
+					low = (planar_lut[plane & 0xff] << 2) | (planar_lut[plane >> 8] << 3);
+			} // fall through
+			case 2: {
+					uint16_t plane = vram[(base_addr + row) & 0x7fff];
+					low |= planar_lut[plane & 0xff] | (planar_lut[plane >> 8] << 1);
 			} break;
 		}
-		// return cgram index, or 0 if transparent, palette number in bits 10-8 for 8-color layers
-		bg_pixel_buf[layer] = (pixel == 0) ? 0 : (paletteNum << bitDepth) + pixel;
-		bg_prio_buf[layer] = tilePrio;
+		// store cgram index, or 0 if transparent, palette number in bits 10-8 for 8-color layers
+		bool hFlipped = tile & 0x4000;
+		for(int px = 0; px < 8; px++) {
+			int shift = (hFlipped ? 7 - px : px) * 4;
+			int pixel = ((low >> shift) & 0xf) | (((high >> shift) & 0xf) << 4);
+			sliverPixels[layer][px] = (pixel == 0) ? 0 : (paletteNum << bitDepth) + pixel;
+		}
 	}
 
 	void Ppu::ppu_calculateMode7Starts(int y) {
@@ -555,16 +754,31 @@ namespace LakeSnes
 		);
 	}
 
+	void Ppu::ppu_renderMode7Line() {
+		// sample the whole line once, stepping the map position by the matrix per pixel (from the right when x-flipped)
+		int stepX = m7xFlip ? -m7matrix[0] : m7matrix[0];
+		int stepY = m7xFlip ? -m7matrix[2] : m7matrix[2];
+		int posX = m7startX + (m7xFlip ? m7matrix[0] * 255 : 0);
+		int posY = m7startY + (m7xFlip ? m7matrix[2] * 255 : 0);
+		for(int x = 0; x < 256; x++) {
+			int xPos = posX >> 8;
+			int yPos = posY >> 8;
+			posX += stepX;
+			posY += stepY;
+			if(m7largeField && (xPos < 0 || xPos >= 1024 || yPos < 0 || yPos >= 1024)) {
+				// outside the map: transparent, or tile 0
+				m7LineBuffer[x] = m7charFill ? vram[(yPos & 7) * 8 + (xPos & 7)] >> 8 : 0;
+				continue;
+			}
+			xPos &= 0x3ff;
+			yPos &= 0x3ff;
+			uint8_t tile = vram[(yPos >> 3) * 128 + (xPos >> 3)] & 0xff;
+			m7LineBuffer[x] = vram[tile * 64 + (yPos & 7) * 8 + (xPos & 7)] >> 8;
+		}
+	}
+
 	int Ppu::ppu_getPixelForMode7(int x, int layer, bool priority) {
-		uint8_t rx = m7xFlip ? 255 - x : x;
-		int xPos = (m7startX + m7matrix[0] * rx) >> 8;
-		int yPos = (m7startY + m7matrix[2] * rx) >> 8;
-		bool outsideMap = xPos < 0 || xPos >= 1024 || yPos < 0 || yPos >= 1024;
-		xPos &= 0x3ff;
-		yPos &= 0x3ff;
-		if(!m7largeField) outsideMap = false;
-		uint8_t tile = outsideMap ? 0 : vram[(yPos >> 3) * 128 + (xPos >> 3)] & 0xff;
-		uint8_t pixel = outsideMap && !m7charFill ? 0 : vram[tile * 64 + (yPos & 7) * 8 + (xPos & 7)] >> 8;
+		uint8_t pixel = m7LineBuffer[x];
 		if(layer == 1) {
 			if(((bool) (pixel & 0x80)) != priority) return 0;
 			return pixel & 0x7f;
@@ -597,89 +811,179 @@ namespace LakeSnes
 		return false;
 	}
 
+	void Ppu::ppu_updateObjCache() {
+		// decode all sprites, and index them by the lines they are on (sprites fully left of the screen never count)
+		objCacheDirty = false;
+		memset(objLineMask, 0, sizeof(objLineMask));
+		for(int i = 0; i < 128; i++) {
+			ObjCacheEntry* obj = &objCache[i];
+			uint16_t attr = oam[i * 2 + 1];
+			uint8_t high = highOam[i >> 2] >> ((i & 3) * 2);
+			obj->size = spriteSizes[objSize][(high >> 1) & 1];
+			int x = (oam[i * 2] & 0xff) | ((high & 1) << 8);
+			if(x > 255) x -= 512;
+			obj->x = x;
+			obj->y = oam[i * 2] >> 8;
+			obj->tile = attr & 0xff;
+			obj->colorBase = 0x80 + 16 * ((attr & 0xe00) >> 9);
+			obj->priority = (attr & 0x3000) >> 12;
+			obj->secondTable = attr & 0x100;
+			obj->hFlipped = attr & 0x4000;
+			obj->vFlipped = attr & 0x8000;
+			if(x <= -obj->size) continue;
+			int height = objInterlace ? obj->size / 2 : obj->size;
+			for(int row = 0; row < height; row++) {
+				uint8_t y = obj->y + row;
+				objLineMask[y][i >> 6] |= 1ull << (i & 63);
+			}
+		}
+	}
+
 	void Ppu::ppu_evaluateSprites(int line) {
 		// TODO: rectangular sprites, wierdness with sprites at -256
-		uint8_t index = objPriority ? (oamAdr & 0xfe) : 0;
+		if(objCacheDirty) ppu_updateObjCache();
+		// sprites on this line, rotated so the first one to check (by priority rotation) is bit 0
+		int first = objPriority ? (oamAdr & 0xfe) >> 1 : 0;
+		uint64_t lo = objLineMask[line][0];
+		uint64_t hi = objLineMask[line][1];
+		if(first >= 64) {
+			uint64_t t = lo;
+			lo = hi;
+			hi = t;
+		}
+		int shift = first & 63;
+		if(shift != 0) {
+			uint64_t t = lo;
+			lo = (lo >> shift) | (hi << (64 - shift));
+			hi = (hi >> shift) | (t << (64 - shift));
+		}
 		int spritesFound = 0;
 		int tilesFound = 0;
 		uint8_t foundSprites[32] = {0};
-		// iterate over oam to find sprites in range
-		for(int i = 0; i < 128; i++) {
-			uint8_t y = oam[index] >> 8;
-			// check if the sprite is on this line and get the sprite size
-			uint8_t row = line - y;
-			int spriteSize = spriteSizes[objSize][(highOam[index >> 3] >> ((index & 7) + 1)) & 1];
-			int spriteHeight = objInterlace ? spriteSize / 2 : spriteSize;
-			if(row < spriteHeight) {
-				// in y-range, get the x location, using the high bit as well
-				int x = oam[index] & 0xff;
-				x |= ((highOam[index >> 3] >> (index & 7)) & 1) << 8;
-				if(x > 255) x -= 512;
-				// if in x-range, record
-				if(x > -spriteSize) {
-					// break if we found 32 sprites already
-					spritesFound++;
-					if(spritesFound > 32) {
-						rangeOver = true;
-						spritesFound = 32;
-						break;
-					}
-					foundSprites[spritesFound - 1] = index;
-				}
+		// take the first 32 sprites in range
+		while(lo | hi) {
+			int bit;
+			if(lo) {
+				bit = LAKESNES_CTZ64(lo);
+				lo &= lo - 1;
+			} else {
+				bit = 64 + LAKESNES_CTZ64(hi);
+				hi &= hi - 1;
 			}
-			index += 2;
+			if(spritesFound == 32) {
+				rangeOver = true;
+				break;
+			}
+			foundSprites[spritesFound++] = (first + bit) & 127;
 		}
 		// iterate over found sprites backwards to fetch max 34 tile slivers
 		for(int i = spritesFound; i > 0; i--) {
-			index = foundSprites[i - 1];
-			uint8_t y = oam[index] >> 8;
-			uint8_t row = line - y;
-			int spriteSize = spriteSizes[objSize][(highOam[index >> 3] >> ((index & 7) + 1)) & 1];
-			int x = oam[index] & 0xff;
-			x |= ((highOam[index >> 3] >> (index & 7)) & 1) << 8;
-			if(x > 255) x -= 512;
-			if(x > -spriteSize) {
-				// update row according to obj-interlace
-				if(objInterlace) row = row * 2 + (evenFrame ? 0 : 1);
-				// get some data for the sprite and y-flip row if needed
-				int tile = oam[index + 1] & 0xff;
-				int palette = (oam[index + 1] & 0xe00) >> 9;
-				bool hFlipped = oam[index + 1] & 0x4000;
-				if(oam[index + 1] & 0x8000) row = spriteSize - 1 - row;
-				// fetch all tiles in x-range
-				for(int col = 0; col < spriteSize; col += 8) {
-					if(col + x > -8 && col + x < 256) {
-						// break if we found > 34 8*1 slivers already
-						tilesFound++;
-						if(tilesFound > 34) {
-							timeOver = true;
-							break;
-						}
-						// figure out which tile this uses, looping within 16x16 pages, and get it's data
-						int usedCol = hFlipped ? spriteSize - 1 - col : col;
-						uint8_t usedTile = (((tile >> 4) + (row / 8)) << 4) | (((tile & 0xf) + (usedCol / 8)) & 0xf);
-						uint16_t objAdr = (oam[index + 1] & 0x100) ? objTileAdr2 : objTileAdr1;
-						uint16_t plane1 = vram[(objAdr + usedTile * 16 + (row & 0x7)) & 0x7fff];
-						uint16_t plane2 = vram[(objAdr + usedTile * 16 + 8 + (row & 0x7)) & 0x7fff];
-						// go over each pixel
-						for(int px = 0; px < 8; px++) {
-							int shift = hFlipped ? px : 7 - px;
-							int pixel = (plane1 >> shift) & 1;
-							pixel |= ((plane1 >> (8 + shift)) & 1) << 1;
-							pixel |= ((plane2 >> shift) & 1) << 2;
-							pixel |= ((plane2 >> (8 + shift)) & 1) << 3;
-							// draw it in the buffer if there is a pixel here
-							int screenCol = col + x + px;
-							if(pixel > 0 && screenCol >= 0 && screenCol < 256) {
-								objPixelBuffer[screenCol] = 0x80 + 16 * palette + pixel;
-								objPriorityBuffer[screenCol] = (oam[index + 1] & 0x3000) >> 12;
-							}
+			const ObjCacheEntry* obj = &objCache[foundSprites[i - 1]];
+			int spriteSize = obj->size;
+			int x = obj->x;
+			uint8_t row = line - obj->y;
+			// update row according to obj-interlace
+			if(objInterlace) row = row * 2 + (evenFrame ? 0 : 1);
+			// y-flip row if needed
+			if(obj->vFlipped) row = spriteSize - 1 - row;
+			uint16_t objAdr = obj->secondTable ? objTileAdr2 : objTileAdr1;
+			// fetch all tiles in x-range
+			for(int col = 0; col < spriteSize; col += 8) {
+				if(col + x > -8 && col + x < 256) {
+					// break if we found > 34 8*1 slivers already
+					tilesFound++;
+					if(tilesFound > 34) {
+						timeOver = true;
+						break;
+					}
+					// figure out which tile this uses, looping within 16x16 pages, and get it's data
+					int usedCol = obj->hFlipped ? spriteSize - 1 - col : col;
+					uint8_t usedTile = (((obj->tile >> 4) + (row / 8)) << 4) | (((obj->tile & 0xf) + (usedCol / 8)) & 0xf);
+					uint16_t plane1 = vram[(objAdr + usedTile * 16 + (row & 0x7)) & 0x7fff];
+					uint16_t plane2 = vram[(objAdr + usedTile * 16 + 8 + (row & 0x7)) & 0x7fff];
+					// all 8 pixels at once, a nibble each
+					uint32_t pixels = planar_lut[plane1 & 0xff] | (planar_lut[plane1 >> 8] << 1);
+					pixels |= (planar_lut[plane2 & 0xff] << 2) | (planar_lut[plane2 >> 8] << 3);
+					if(pixels == 0) continue;
+					// go over each pixel
+					for(int px = 0; px < 8; px++) {
+						int pixel = (pixels >> ((obj->hFlipped ? 7 - px : px) * 4)) & 0xf;
+						// draw it in the buffer if there is a pixel here
+						int screenCol = col + x + px;
+						if(pixel > 0 && screenCol >= 0 && screenCol < 256) {
+							objPixelBuffer[screenCol] = obj->colorBase + pixel;
+							objPriorityBuffer[screenCol] = obj->priority;
 						}
 					}
 				}
-				if(tilesFound > 34) break; // break out of sprite-loop if max tiles found
+			}
+			if(tilesFound > 34) break; // break out of sprite-loop if max tiles found
+		}
+	}
+
+	void Ppu::ppu_writeVramWords(const uint8_t* data, int words) {
+		// note any difference to the old contents, for the change detection
+		uint16_t diff = 0;
+		if(vramIncrement != 1) {
+			for(int i = 0; i < words; i++) {
+				uint16_t word = data[i * 2] | (data[i * 2 + 1] << 8);
+				diff |= vram[vramPointer & 0x7fff] ^ word;
+				vram[vramPointer & 0x7fff] = word;
+				vramPointer += vramIncrement;
+			}
+			if(diff) vramGeneration++;
+			return;
+		}
+		// consecutive words, split where the address wraps
+		while(words > 0) {
+			int adr = vramPointer & 0x7fff;
+			int count = 0x8000 - adr;
+			if(count > words) count = words;
+			uint16_t* dest = &vram[adr];
+			for(int i = 0; i < count; i++) {
+				uint16_t word = data[i * 2] | (data[i * 2 + 1] << 8);
+				diff |= dest[i] ^ word;
+				dest[i] = word;
+			}
+			vramPointer += count;
+			data += count * 2;
+			words -= count;
+		}
+		if(diff) vramGeneration++;
+	}
+
+	void Ppu::ppu_writeCgramWords(const uint8_t* data, int words) {
+		uint16_t diff = 0;
+		int first = cgramPointer;
+		for(int i = 0; i < words; i++) {
+			uint16_t color = data[i * 2] | (data[i * 2 + 1] << 8);
+			diff |= cgram[cgramPointer] ^ color;
+			cgram[cgramPointer++] = color;
+		}
+		if(diff) {
+			cgramGeneration++;
+			ppu_updatePalette(first, words < 0x100 ? words : 0x100);
+		}
+		if(words > 0) cgramBuffer = data[words * 2 - 2];
+	}
+
+	int Ppu::ppu_writeOamWords(const uint8_t* data, int words) {
+		int done = 0;
+		uint16_t diff = 0;
+		while(done < words) {
+			uint16_t word = data[done * 2] | (data[done * 2 + 1] << 8);
+			diff |= oam[oamAdr] ^ word;
+			oam[oamAdr++] = word;
+			done++;
+			if(oamAdr == 0) {
+				oamInHigh = true;
+				break;
 			}
 		}
+		if(done > 0) oamBuffer = data[done * 2 - 2];
+		if(diff) oamGeneration++;
+		objCacheDirty = true;
+		return done;
 	}
 
 	uint16_t Ppu::ppu_getVramRemap() {
@@ -826,13 +1130,17 @@ namespace LakeSnes
 			case 0x00: {
 				// TODO: oam address reset when written on first line of vblank, (and when forced blank is disabled?)
 				brightness = val & 0xf;
-				bright_now = bright_lut[brightness];
+				if(paletteBright != bright_lut[brightness]) {
+					paletteBright = bright_lut[brightness];
+					ppu_updatePalette(0, 0x100);
+				}
 				forcedBlank = val & 0x80;
 				rawINIDISP = val;
 				break;
 			}
 			case 0x01: {
 				objSize = val >> 5;
+				objCacheDirty = true;
 				objTileAdr1 = (val & 7) << 13;
 				objTileAdr2 = objTileAdr1 + (((val & 0x18) + 8) << 9);
 				rawOBSEL = val;
@@ -855,6 +1163,7 @@ namespace LakeSnes
 			}
 			case 0x04: {
 				if(oamInHigh) {
+					if(val != highOam[((oamAdr & 0xf) << 1) | oamSecondWrite]) oamGeneration++;
 					highOam[((oamAdr & 0xf) << 1) | oamSecondWrite] = val;
 					if(oamSecondWrite) {
 						oamAdr++;
@@ -864,11 +1173,14 @@ namespace LakeSnes
 					if(!oamSecondWrite) {
 						oamBuffer = val;
 					} else {
-						oam[oamAdr++] = (val << 8) | oamBuffer;
+						uint16_t word = (val << 8) | oamBuffer;
+						if(word != oam[oamAdr]) oamGeneration++;
+						oam[oamAdr++] = word;
 						if(oamAdr == 0) oamInHigh = true;
 					}
 				}
 				oamSecondWrite = !oamSecondWrite;
+				objCacheDirty = true;
 				break;
 			}
 			case 0x05: {
@@ -961,13 +1273,17 @@ namespace LakeSnes
 			case 0x18: {
 				// TODO: vram access during rendering (also cgram and oam)
 				uint16_t vramAdr = ppu_getVramRemap();
-				vram[vramAdr & 0x7fff] = (vram[vramAdr & 0x7fff] & 0xff00) | val;
+				uint16_t word = (vram[vramAdr & 0x7fff] & 0xff00) | val;
+				if(word != vram[vramAdr & 0x7fff]) vramGeneration++;
+				vram[vramAdr & 0x7fff] = word;
 				if(!vramIncrementOnHigh) vramPointer += vramIncrement;
 				break;
 			}
 			case 0x19: {
 				uint16_t vramAdr = ppu_getVramRemap();
-				vram[vramAdr & 0x7fff] = (vram[vramAdr & 0x7fff] & 0x00ff) | (val << 8);
+				uint16_t word = (vram[vramAdr & 0x7fff] & 0x00ff) | (val << 8);
+				if(word != vram[vramAdr & 0x7fff]) vramGeneration++;
+				vram[vramAdr & 0x7fff] = word;
 				if(vramIncrementOnHigh) vramPointer += vramIncrement;
 				break;
 			}
@@ -1001,7 +1317,13 @@ namespace LakeSnes
 				if(!cgramSecondWrite) {
 					cgramBuffer = val;
 				} else {
-					cgram[cgramPointer++] = (val << 8) | cgramBuffer;
+					uint16_t color = (val << 8) | cgramBuffer;
+					if(color != cgram[cgramPointer]) {
+						cgramGeneration++;
+						cgram[cgramPointer] = color;
+						ppu_updatePalette(cgramPointer, 1);
+					}
+					cgramPointer++;
 				}
 				cgramSecondWrite = !cgramSecondWrite;
 				break;
@@ -1112,6 +1434,7 @@ namespace LakeSnes
 			case 0x33: {
 				interlace = val & 0x1;
 				objInterlace = val & 0x2;
+				objCacheDirty = true;
 				overscan = val & 0x4;
 				pseudoHires = val & 0x8;
 				m7extBg = val & 0x40;
@@ -1127,21 +1450,28 @@ namespace LakeSnes
 	void Ppu::GetFramebufferInfo(Ppu::FramebufferInfo* info)
 	{
 		info->Pixels = config.pixelBuffer;
+		info->Pitch = config.pixelPitch;
+		info->Width = config.pixelHires ? 512 : 256;
+		info->Format = config.pixelFormat;
 		info->FrameOverscan = frameOverscan;
 		info->FrameInterlaced = frameInterlace;
 		info->EvenFrame = evenFrame;
+		info->FrameUnchanged = frameUnchanged;
+		for(int i = 0; i < 4; i++) info->LinesChanged[i] = frameLinesChanged[i];
 	}
 
 	void Ppu::ppu_putPixels(uint8_t* outPixels) {
+		if(config.pixelFormat != PixelFormat::XRGB8888 || !config.pixelHires) return;
+		int field = evenFrame ? 0 : 1;
 		for(int y = 0; y < (frameOverscan ? 239 : 224); y++) {
 			int dest = y * 2 + (frameOverscan ? 2 : 16);
-			int y1 = y, y2 = y + 239;
+			int y1 = y * 2, y2 = y * 2 + 1;
 			if(!frameInterlace) {
-				y1 = y + (evenFrame ? 0 : 239);
+				y1 = y * 2 + field;
 				y2 = y1;
 			}
-			memcpy(outPixels + (dest * 2048), &config.pixelBuffer[y1 * 2048], 2048);
-			memcpy(outPixels + ((dest + 1) * 2048), &config.pixelBuffer[y2 * 2048], 2048);
+			memcpy(outPixels + (dest * 2048), &config.pixelBuffer[y1 * config.pixelPitch], 2048);
+			memcpy(outPixels + ((dest + 1) * 2048), &config.pixelBuffer[y2 * config.pixelPitch], 2048);
 		}
 		// clear top 2 lines, and following 14 and last 16 lines if not overscanning
 		memset(outPixels, 0, 2048 * 2);
@@ -1151,4 +1481,4 @@ namespace LakeSnes
 		}
 	}
 
-}
\ No newline at end of file
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "conf.h"
 
 namespace LakeSnes
 {
@@ -32,6 +36,27 @@ namespace LakeSnes
 		uint8_t maskLogic;
 	};
 
+	enum class PixelFormat
+	{
+		XRGB8888, // 4 bytes, 0x00rrggbb
+		RGB565, // 2 bytes
+		BGR555, // 2 bytes, the snes' own format (0bbbbbgggggrrrrr)
+		Indexed, // 1 byte, the main screen's cgram index, before color math and brightness (look it up in Ppu::cgram)
+	};
+
+	// sprite attributes as decoded from oam (and the obj size), see Ppu::ppu_updateObjCache
+	struct ObjCacheEntry {
+		int16_t x;
+		uint8_t y;
+		uint8_t size;
+		uint8_t tile;
+		uint8_t colorBase; // 0x80 + 16 * palette
+		uint8_t priority;
+		bool secondTable;
+		bool hFlipped;
+		bool vFlipped;
+	};
+
 	class Ppu
 	{
 	public:
@@ -47,47 +72,86 @@ namespace LakeSnes
 		uint8_t ppu_read(uint8_t adr);
 		void ppu_write(uint8_t adr, uint8_t val);
 		void ppu_latchHV();
+		// bulk dma: same as writing the (low, high) byte pairs to $2118/$2119 (no remap), $2122 or $2104,
+		// starting on a low byte; the oam one stops at the high table and returns how many pairs it took
+		void ppu_writeVramWords(const uint8_t* data, int words);
+		void ppu_writeCgramWords(const uint8_t* data, int words);
+		int ppu_writeOamWords(const uint8_t* data, int words);
 
 		//You can use this to convert emit a friendlier-format 512x480x4BPP buffer.
 		//You won't have to worry about resolutions and interlacing.
 		//(Note that interlacing is already applied by this method in a weave manner)
+		//Only for the default output (XRGB8888, 512 wide); otherwise, use the buffer directly.
 		void ppu_putPixels(uint8_t* outPixels);
 
 		struct FramebufferInfo
 		{
 			//The pixel data. You configured this yourself, but it's just here for convenience.
+			//Rows alternate between the two fields; a progressive frame only has the rows of its own field
+			//(even rows for an even frame), an interlaced frame has both.
 			uint8_t* Pixels;
 
+			//Bytes per row, pixels per row (256 or 512) and the pixel format, as configured
+			int Pitch;
+			int Width;
+			PixelFormat Format;
+
 			//If "overscan" was enabled for the frame (239 lines instead of 224)
 			bool FrameOverscan;
 
 			//If "interlaced" is enabled for the frame
 			bool FrameInterlaced;
 
-			//in case of "FrameInterlaced", indicates whether the current frame is odd or even.
+			//indicates whether the current frame is odd or even (which field a progressive frame went to)
 			bool EvenFrame;
+
+			//If every line came out the same as in the previous frame, so presenting or encoding it can be skipped
+			bool FrameUnchanged;
+
+			//One bit per line (line n is bit n % 64 of word n / 64), set for lines that may differ from the previous frame.
+			//A line is compared as a whole (both rows for an interlaced frame, which never count as unchanged).
+			//With frame slots, this is against the previous sequence number; after a skipped frame, take every line as changed.
+			uint64_t LinesChanged[4];
 		};
 
 		//After a frame is run, the buffer you provided to Snes::Init() will contain the pixel data
 		//This method gets information about that framebuffer, so you can display it correctly.
+		//(With frame slots, this is the slot being rendered; use ppu_acquireFrame instead.)
 		void GetFramebufferInfo(Ppu::FramebufferInfo* info);
 
+		//Frame slots, see Snes::snes_setFrameSlots
+		void ppu_setFrameSlots(uint8_t* slots[3]);
+		const uint8_t* ppu_acquireFrame(Ppu::FramebufferInfo* info, uint64_t* sequence);
+
 	private:
+		void ppu_publishFrame();
+		uint64_t ppu_lineSignature();
+		void ppu_latchChanges();
 		void ppu_handlePixel(int x, int y);
+		void ppu_updatePalette(int first, int count);
+		uint32_t ppu_packColor(int r, int g, int b);
+		uint16_t ppu_packColor16(int r, int g, int b, bool rgb565);
 		int ppu_getPixel(int x, int y, bool sub, int* r, int* g, int* b);
 		void ppu_handleOPT(int layer, int* lx, int* ly);
 		uint16_t ppu_getOffsetValue(int col, int row);
+		void ppu_fetchOffsets();
 		void ppu_getPixelForBgLayer(int x, int y, int layer);
+		void ppu_decodeBgSliver(int x, int y, int layer);
 		void ppu_calculateMode7Starts(int y);
+		void ppu_renderMode7Line();
 		int ppu_getPixelForMode7(int x, int layer, bool priority);
 		bool ppu_getWindowState(int layer, int x);
 		void ppu_evaluateSprites(int line);
+		void ppu_updateObjCache();
 		uint16_t ppu_getVramRemap();
 
 		public:
 			struct {
 				Snes* snes;
 				uint8_t* pixelBuffer;
+				int pixelPitch;
+				PixelFormat pixelFormat;
+				bool pixelHires;
 			} config;
 
 		// vram access
@@ -116,6 +180,7 @@ namespace LakeSnes
 		bool timeOver;
 		bool rangeOver;
 		bool objInterlace;
+		bool objCacheDirty; // set by anything that changes the sprite cache below
 		// background layers
 		BgLayer bgLayer[4];
 		uint8_t scrollPrev;
@@ -138,6 +203,18 @@ namespace LakeSnes
 		// mode 7 internal
 		int32_t m7startX;
 		int32_t m7startY;
+		uint8_t m7LineBuffer[256]; // raw mode 7 pixels of the current line, bit 7 is the extbg priority
+		// line rendering: last decoded 8-pixel tile row per layer (as bgPixelBuf values), so each row is only
+		// decoded once; hi-res lines take both their even and odd columns from it
+		int sliverCache[4];
+		uint16_t sliverPixels[4][8];
+		uint8_t sliverPrio[4];
+		uint16_t bgPixelBuf[4];
+		uint8_t bgPrioBuf[4];
+		bool bgWindowState[6]; // 0-3 (bg) 4 (spr) 5 (colorwind)
+		uint16_t optOffsets[2][64]; // offset-per-tile values of the current line, per bg3 column (row 0: h, row 1: v)
+		uint8_t pixelIndex[2]; // cgram index of the last main and sub screen pixel, for indexed output
+		uint8_t* linePixels; // row of the output for the current line
 		// windows
 		WindowLayer windowLayer[6];
 		uint8_t window1left;
@@ -186,13 +263,41 @@ namespace LakeSnes
 
 		//larger buffers
 		uint16_t cgram[0x100];
+		uint32_t paletteOut[0x100]; // cgram as output colors at the current brightness (16 bit formats in the low half)
+		uint32_t paletteBright; // brightness factor paletteOut was built with
 		uint16_t oam[0x100];
 		uint8_t objPixelBuffer[256]; // line buffers
 		uint8_t objPriorityBuffer[256];
+		// sprite cache: per-sprite attributes, and per line a mask of the sprites that are on it
+		ObjCacheEntry objCache[128];
+		uint64_t objLineMask[256][2];
+		// change detection: the generations count writes that actually changed vram, cgram or oam, a line's
+		// signature hashes them with everything else the line's pixels depend on (see ppu_lineSignature)
+		uint32_t vramGeneration;
+		uint32_t cgramGeneration;
+		uint32_t oamGeneration;
+		uint64_t lineSignature[239]; // as of the last frame that rendered the line
+		uint64_t linesChanged[4]; // current frame so far
+		uint64_t frameLinesChanged[4]; // last finished frame (latched at vblank)
+		bool frameUnchanged;
+		bool lastFrameOverscan;
+		bool lastFrameInterlace;
+
+		//frame slots: a triple buffer; the emulation thread renders into the back slot and swaps it with
+		//the shared one when done, the consumer swaps its front slot with the shared one when that is fresh
+		static const int frameSlotFresh = 4;
+		uint8_t* frameSlots[3] = {};
+		FramebufferInfo frameSlotInfo[3];
+		uint64_t frameSlotSequence[3];
+		uint64_t frameSequence = 0;
+		int frameSlotBack = 0; // emulation thread
+		int frameSlotFront = 1; // consumer thread
+		std::atomic<int> frameSlotShared{2};
 
 		//vram
-		uint16_t vram[0x8000];
+		alignas(LAKESNES_PAGE) uint16_t vram[0x8000];
 	};
+	static_assert(offsetof(Ppu, vram) % LAKESNES_PAGE == 0, "vram should start on a page");
 
 
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "profile.h"
+#include "snes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+
+namespace
+{
+	int profile_compare(const void* a, const void* b) {
+		uint64_t ca = ((const LakeSnes::ProfileEntry*)a)->cycles;
+		uint64_t cb = ((const LakeSnes::ProfileEntry*)b)->cycles;
+		return ca < cb ? 1 : (ca > cb ? -1 : 0);
+	}
+}
+
+namespace LakeSnes
+{
+	void ProfileMap::map_init() {
+		bits = 12;
+		entries = (ProfileEntry*)malloc(sizeof(ProfileEntry) << bits);
+		map_clear();
+	}
+
+	void ProfileMap::map_free() {
+		free(entries);
+		entries = NULL;
+	}
+
+	void ProfileMap::map_clear() {
+		for(uint32_t i = 0; i < (1u << bits); i++) entries[i].key = emptyKey;
+		used = 0;
+	}
+
+	ProfileEntry* ProfileMap::map_get(uint32_t key, bool* created) {
+		uint32_t mask = (1u << bits) - 1;
+		uint32_t i = (key * 2654435761u) >> (32 - bits);
+		while(entries[i].key != key) {
+			if(entries[i].key == emptyKey) {
+				if((used + 1) * 2 > mask + 1) {
+					// keep it at most half full, then look again
+					ProfileEntry* old = entries;
+					bits++;
+					entries = (ProfileEntry*)malloc(sizeof(ProfileEntry) << bits);
+					for(uint32_t j = 0; j < (1u << bits); j++) entries[j].key = emptyKey;
+					for(uint32_t j = 0; j <= mask; j++) {
+						if(old[j].key == emptyKey) continue;
+						uint32_t k = (old[j].key * 2654435761u) >> (32 - bits);
+						while(entries[k].key != emptyKey) k = (k + 1) & ((1u << bits) - 1);
+						entries[k] = old[j];
+					}
+					free(old);
+					return map_get(key, created);
+				}
+				used++;
+				memset(&entries[i], 0, sizeof(ProfileEntry));
+				entries[i].key = key;
+				*created = true;
+				return &entries[i];
+			}
+			i = (i + 1) & mask;
+		}
+		*created = false;
+		return &entries[i];
+	}
+
+	void Profiler::profiler_init(Snes* snes) {
+		this->snes = snes;
+		enabled = false;
+		cpuCycles = 0;
+		spcCycles = 0;
+	}
+
+	void Profiler::profiler_free() {
+		enabled = false;
+		cpu.map_free();
+		spc.map_free();
+	}
+
+	void Profiler::profiler_enable(bool enabled) {
+		if(enabled && cpu.entries == NULL) {
+			cpu.map_init();
+			spc.map_init();
+			cpuCycles = 0;
+			spcCycles = 0;
+		}
+		spcKey = snes->myapu.myspc.pc;
+		hostCountdown = hostSampleInterval;
+		this->enabled = enabled;
+	}
+
+	void Profiler::profiler_clear() {
+		if(cpu.entries == NULL) return;
+		cpu.map_clear();
+		spc.map_clear();
+		cpuCycles = 0;
+		spcCycles = 0;
+	}
+
+	int Profiler::profiler_top(bool spc, ProfileEntry* entries, int maxEntries) {
+		ProfileMap& map = spc ? this->spc : cpu;
+		if(map.entries == NULL) return 0;
+		ProfileEntry* all = (ProfileEntry*)malloc(map.used * sizeof(ProfileEntry) + 1);
+		int count = 0;
+		for(uint32_t i = 0; i < (1u << map.bits); i++) {
+			if(map.entries[i].key != ProfileMap::emptyKey) all[count++] = map.entries[i];
+		}
+		qsort(all, count, sizeof(ProfileEntry), profile_compare);
+		if(count > maxEntries) count = maxEntries;
+		memcpy(entries, all, count * sizeof(ProfileEntry));
+		free(all);
+		return count;
+	}
+
+	uint64_t Profiler::profiler_hostStart() {
+		// timing every instruction would cost more than most instructions take
+		if(--hostCountdown > 0) return 0;
+		hostCountdown = hostSampleInterval;
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+
+	uint64_t Profiler::profiler_hostEnd(uint64_t start) {
+		if(start == 0) return 0;
+		uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+		return (now - start) * hostSampleInterval;
+	}
+
+	ProfileCpuScope::ProfileCpuScope(Profiler* profiler) {
+		this->profiler = profiler;
+		if(profiler == NULL) return;
+		Cpu& cpu = profiler->snes->mycpu;
+		key = (cpu.k << 16 | cpu.pc) | (cpu.intWanted ? Profiler::keyInterrupt : 0);
+		flags = cpu._mf << 5 | cpu._xf << 4;
+		startCycles = profiler->snes->cycles;
+		startHost = profiler->profiler_hostStart();
+	}
+
+	ProfileCpuScope::~ProfileCpuScope() {
+		if(profiler == NULL) return;
+		Snes* snes = profiler->snes;
+		uint64_t cycles = snes->cycles - startCycles;
+		bool created;
+		ProfileEntry* entry = profiler->cpu.map_get(key, &created);
+		if(created) {
+			// peek without side effects, as the tracer does
+			for(int i = 0; i < 4; i++) {
+				uint32_t adr = (key & 0xffffff) + i;
+				int length;
+				const uint8_t* code = snes->mycpu.dma_getReadPointer((adr >> 16) & 0xff, adr & 0xffff, &length);
+				entry->bytes[i] = code != NULL ? *code : 0;
+			}
+			entry->flags = flags;
+		}
+		entry->count++;
+		entry->cycles += cycles;
+		entry->hostNs += profiler->profiler_hostEnd(startHost);
+		profiler->cpuCycles += cycles;
+	}
+
+	ProfileSpcScope::ProfileSpcScope(Profiler* profiler) {
+		this->profiler = profiler;
+		if(profiler == NULL) return;
+		Spc& spc = profiler->snes->myapu.myspc;
+		// an opcode fetch starts the next instruction, the steps after it belong to the same one
+		starting = !spc.resetWanted && !spc.stopped && spc.step == 0;
+		if(starting) profiler->spcKey = spc.pc;
+		startCycles = profiler->snes->myapu.cycles;
+		startHost = profiler->profiler_hostStart();
+	}
+
+	ProfileSpcScope::~ProfileSpcScope() {
+		if(profiler == NULL) return;
+		Apu& apu = profiler->snes->myapu;
+		uint64_t cycles = apu.cycles - startCycles;
+		bool created;
+		ProfileEntry* entry = profiler->spc.map_get(profiler->spcKey, &created);
+		if(created) {
+			for(int i = 0; i < 3; i++) entry->bytes[i] = apu.apu_peek((profiler->spcKey + i) & 0xffff);
+		}
+		if(starting) entry->count++;
+		entry->cycles += cycles;
+		entry->hostNs += profiler->profiler_hostEnd(startHost);
+		profiler->spcCycles += cycles;
+	}
+
+}
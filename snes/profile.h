@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace LakeSnes
+{
+	class Snes;
+
+	// what ran at one address
+	struct ProfileEntry
+	{
+		uint32_t key; // pc (24 bit for the cpu, 16 for the spc), plus Profiler::keyInterrupt
+		uint32_t count; // instructions started
+		uint64_t cycles; // master cycles for the cpu (including dma it set off), apu cycles for the spc
+		uint64_t hostNs; // estimated from 1 in Profiler::hostSampleInterval
+		uint8_t bytes[4]; // opcode and operands when first seen (0 if not plain memory)
+		uint8_t flags; // cpu m and x flag (0x20, 0x10) when first seen
+	};
+	static_assert(sizeof(ProfileEntry) == 32, "profile entries should stay compact");
+
+	// open addressing hash map from key to entry, grows as needed
+	class ProfileMap
+	{
+	public:
+		void map_init();
+		void map_free();
+		void map_clear();
+		ProfileEntry* map_get(uint32_t key, bool* created);
+
+	public:
+		static const uint32_t emptyKey = 0xffffffff;
+		ProfileEntry* entries = NULL;
+		int bits;
+		uint32_t used;
+	};
+
+	// Hot code profiler. When built with LAKESNES_CONFIG_PROFILE, the cpu and spc add the cycles (and, sampled,
+	// host time) each instruction takes to the address it started at while enabled (without the define the hooks
+	// aren't compiled at all). Emulation thread only; see dumpProfile in tracing.cpp for a report.
+	class Profiler
+	{
+	public:
+		static const uint32_t keyInterrupt = 0x1000000; // an interrupt taken instead of the opcode at the pc
+		static const int hostSampleInterval = 64;
+
+		void profiler_init(Snes* snes);
+		void profiler_free();
+		void profiler_enable(bool enabled);
+		void profiler_clear();
+		// the entries with the most cycles (at most maxEntries, most first), returns how many
+		int profiler_top(bool spc, ProfileEntry* entries, int maxEntries);
+		uint64_t profiler_hostStart();
+		uint64_t profiler_hostEnd(uint64_t start);
+
+	public:
+		Snes* snes;
+		bool enabled = false;
+		ProfileMap cpu;
+		ProfileMap spc;
+		uint64_t cpuCycles; // totals
+		uint64_t spcCycles;
+		uint32_t spcKey; // instruction the spc is in (it runs them a cycle at a time)
+		int hostCountdown;
+	};
+
+	// around Cpu::cpu_runOpcode and Spc::spc_runOpcode, profiler is NULL if not enabled
+	class ProfileCpuScope
+	{
+	public:
+		ProfileCpuScope(Profiler* profiler);
+		~ProfileCpuScope();
+
+	private:
+		Profiler* profiler;
+		uint32_t key;
+		uint8_t flags;
+		uint64_t startCycles;
+		uint64_t startHost;
+	};
+
+	class ProfileSpcScope
+	{
+	public:
+		ProfileSpcScope(Profiler* profiler);
+		~ProfileSpcScope();
+
+	private:
+		Profiler* profiler;
+		bool starting;
+		uint64_t startCycles;
+		uint64_t startHost;
+	};
+
+}
@@ -0,0 +1,495 @@
+#include "romimage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <mutex>
+#include <unordered_map>
+
+// miniz, as bundled with the zip library from https://github.com/kuba--/zip (implemented in zip.c)
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+	using LakeSnes::CartHeader;
+	using LakeSnes::RomImage;
+
+	// registered images by hash (a 64 bit collision between two roms isn't a practical concern)
+	std::mutex romimage_lock;
+	std::unordered_map<uint64_t, RomImage*> romimage_registry;
+
+	void readHeader(const uint8_t* data, int length, int location, CartHeader* header) {
+		// read name, TODO: non-ASCII names?
+		for(int i = 0; i < 21; i++) {
+			uint8_t ch = data[location + i];
+			if(ch >= 0x20 && ch < 0x7f) {
+				header->name[i] = ch;
+			} else {
+				header->name[i] = '.';
+			}
+		}
+		header->name[21] = 0;
+		// read rest
+		header->speed = data[location + 0x15] >> 4;
+		header->type = data[location + 0x15] & 0xf;
+		header->coprocessor = data[location + 0x16] >> 4;
+		header->chips = data[location + 0x16] & 0xf;
+		header->romSize = 0x400 << data[location + 0x17];
+		header->ramSize = 0x400 << data[location + 0x18];
+		header->region = data[location + 0x19];
+		header->maker = data[location + 0x1a];
+		header->version = data[location + 0x1b];
+		header->checksumComplement = (data[location + 0x1d] << 8) + data[location + 0x1c];
+		header->checksum = (data[location + 0x1f] << 8) + data[location + 0x1e];
+		// read v3 and/or v2
+		header->headerVersion = 1;
+		if(header->maker == 0x33) {
+			header->headerVersion = 3;
+			// maker code
+			for(int i = 0; i < 2; i++) {
+				uint8_t ch = data[location - 0x10 + i];
+				if(ch >= 0x20 && ch < 0x7f) {
+					header->makerCode[i] = ch;
+				} else {
+					header->makerCode[i] = '.';
+				}
+			}
+			header->makerCode[2] = 0;
+			// game code
+			for(int i = 0; i < 4; i++) {
+				uint8_t ch = data[location - 0xe + i];
+				if(ch >= 0x20 && ch < 0x7f) {
+					header->gameCode[i] = ch;
+				} else {
+					header->gameCode[i] = '.';
+				}
+			}
+			header->gameCode[4] = 0;
+			header->flashSize = 0x400 << data[location - 4];
+			header->exRamSize = 0x400 << data[location - 3];
+			header->specialVersion = data[location - 2];
+			header->exCoprocessor = data[location - 1];
+		} else if(data[location + 0x14] == 0) {
+			header->headerVersion = 2;
+			header->exCoprocessor = data[location - 1];
+		}
+		// get region
+		header->pal = (header->region >= 0x2 && header->region <= 0xc) || header->region == 0x11;
+		header->cartType = location < 0x9000 ? 1 : 2;
+		if(location > 0x400000) header->cartType = 3;
+		// get score
+		// TODO: check name, maker/game-codes (if V3) for ASCII, more vectors,
+		//   more first opcode, rom-sizes (matches?), type (matches header location?)
+		int score = 0;
+		score += (header->speed == 2 || header->speed == 3) ? 5 : -4;
+		score += (header->type <= 3 || header->type == 5) ? 5 : -2;
+		score += (header->coprocessor <= 5 || header->coprocessor >= 0xe) ? 5 : -2;
+		score += (header->chips <= 6 || header->chips == 9 || header->chips == 0xa) ? 5 : -2;
+		score += (header->region <= 0x14) ? 5 : -2;
+		score += (header->checksum + header->checksumComplement == 0xffff) ? 8 : -6;
+		uint16_t resetVector = data[location + 0x3c] | (data[location + 0x3d] << 8);
+		score += (resetVector >= 0x8000) ? 8 : -20;
+		// check first opcode after reset
+		int opcodeLoc = location + 0x40 - 0x8000 + (resetVector & 0x7fff);
+		uint8_t opcode = 0xff;
+		if(opcodeLoc < length) {
+			opcode = data[opcodeLoc];
+		} else {
+			score -= 14;
+		}
+		if(opcode == 0x78 || opcode == 0x18) {
+			// sei, clc (for clc:xce)
+			score += 6;
+		}
+		if(opcode == 0x4c || opcode == 0x5c || opcode == 0x9c) {
+			// jmp abs, jml abl, stz abs
+			score += 3;
+		}
+		if(opcode == 0x00 || opcode == 0xff || opcode == 0xdb) {
+			// brk, sbc alx, stp
+			score -= 6;
+		}
+		header->score = score;
+	}
+
+	// declared sizes of compressed roms aren't trusted past this (well beyond any cart)
+	const int maxCompressedLength = 0x4000000;
+
+	bool isRomName(const char* name) {
+		int length = strlen(name);
+		if(length < 4) return false;
+		char ext[5];
+		for(int i = 0; i < 5; i++) ext[i] = tolower(name[length - 4 + i]);
+		return strcmp(ext, ".sfc") == 0 || strcmp(ext, ".smc") == 0;
+	}
+
+	// the first .sfc/.smc in the zip, inflated straight into an allocation of its stated size
+	uint8_t* readZip(const char* path, int* length) {
+		mz_zip_archive zip;
+		memset(&zip, 0, sizeof(zip));
+		if(!mz_zip_reader_init_file(&zip, path, 0)) return NULL;
+		uint8_t* data = NULL;
+		mz_uint entries = mz_zip_reader_get_num_files(&zip);
+		for(mz_uint i = 0; i < entries; i++) {
+			mz_zip_archive_file_stat stat;
+			if(!mz_zip_reader_file_stat(&zip, i, &stat) || !isRomName(stat.m_filename)) continue;
+			if(stat.m_uncomp_size == 0 || stat.m_uncomp_size > maxCompressedLength) break;
+			*length = (int) stat.m_uncomp_size;
+			data = (uint8_t*)malloc(*length);
+			// checks the crc as well
+			if(!mz_zip_reader_extract_to_mem(&zip, i, data, *length, 0)) {
+				free(data);
+				data = NULL;
+				break;
+			}
+			printf("Read \"%s\" from zip\n", stat.m_filename);
+			break;
+		}
+		mz_zip_reader_end(&zip);
+		return data;
+	}
+
+	// a gzip file (f past the magic), sized from its trailer and inflated in chunks straight into the result
+	uint8_t* readGzip(FILE* f, int* length) {
+		uint8_t header[8];
+		if(fread(header, 8, 1, f) != 1 || header[0] != 8) return NULL; // deflate
+		uint8_t flags = header[1];
+		if(flags & 4) {
+			// extra field
+			uint8_t extra[2];
+			if(fread(extra, 2, 1, f) != 1) return NULL;
+			fseek(f, extra[0] | (extra[1] << 8), SEEK_CUR);
+		}
+		for(int field = 8; field <= 0x10; field <<= 1) {
+			// name, comment (zero terminated)
+			if(!(flags & field)) continue;
+			int ch;
+			while((ch = fgetc(f)) > 0) {}
+			if(ch < 0) return NULL;
+		}
+		if(flags & 2) fseek(f, 2, SEEK_CUR); // header crc
+		long start = ftell(f);
+		uint8_t trailer[8];
+		if(fseek(f, -8, SEEK_END) != 0 || fread(trailer, 8, 1, f) != 1) return NULL;
+		long end = ftell(f) - 8;
+		uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | ((uint32_t) trailer[3] << 24);
+		uint32_t size = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) | ((uint32_t) trailer[7] << 24);
+		if(size == 0 || size > maxCompressedLength || start < 0 || end < start) return NULL;
+		fseek(f, start, SEEK_SET);
+		uint8_t* data = (uint8_t*)malloc(size);
+		tinfl_decompressor* inflator = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+		tinfl_init(inflator);
+		const int chunkSize = 0x10000;
+		uint8_t* chunk = (uint8_t*)malloc(chunkSize);
+		long remaining = end - start;
+		size_t inPos = 0;
+		size_t inSize = 0;
+		size_t outPos = 0;
+		tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+		while(status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+			if(inPos == inSize) {
+				if(remaining == 0) break;
+				inSize = fread(chunk, 1, remaining < chunkSize ? remaining : chunkSize, f);
+				if(inSize == 0) break;
+				remaining -= inSize;
+				inPos = 0;
+			}
+			size_t inBytes = inSize - inPos;
+			size_t outBytes = size - outPos;
+			status = tinfl_decompress(
+				inflator, chunk + inPos, &inBytes, data, data + outPos, &outBytes,
+				TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (remaining > 0 ? TINFL_FLAG_HAS_MORE_INPUT : 0)
+			);
+			inPos += inBytes;
+			outPos += outBytes;
+		}
+		free(chunk);
+		free(inflator);
+		if(status != TINFL_STATUS_DONE || outPos != size || mz_crc32(MZ_CRC32_INIT, data, size) != crc) {
+			free(data);
+			return NULL;
+		}
+		*length = (int) size;
+		return data;
+	}
+
+	inline uint64_t xxh64_rotl(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t xxh64_read64(const uint8_t* p) {
+		uint64_t v;
+		memcpy(&v, p, 8); // little-endian host assumed, as for the rest
+		return v;
+	}
+
+	const uint64_t xxh64_prime1 = 0x9e3779b185ebca87ull;
+	const uint64_t xxh64_prime2 = 0xc2b2ae3d27d4eb4full;
+	const uint64_t xxh64_prime3 = 0x165667b19e3779f9ull;
+	const uint64_t xxh64_prime4 = 0x85ebca77c2b2ae63ull;
+	const uint64_t xxh64_prime5 = 0x27d4eb2f165667c5ull;
+
+	inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+		acc += input * xxh64_prime2;
+		return xxh64_rotl(acc, 31) * xxh64_prime1;
+	}
+
+	inline uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+		acc ^= xxh64_round(0, v);
+		return acc * xxh64_prime1 + xxh64_prime4;
+	}
+}
+
+namespace LakeSnes
+{
+	RomImage* RomImage::romimage_create(const uint8_t* data, int length) {
+		uint64_t hash = romimage_hash(data, length);
+		std::lock_guard<std::mutex> guard(romimage_lock);
+		auto found = romimage_registry.find(hash);
+		// the hash only finds the candidate, sharing it takes the same bytes
+		if(found != romimage_registry.end() && found->second->length == length && memcmp(found->second->data, data, length) == 0) {
+			found->second->refs++;
+			return found->second;
+		}
+		uint8_t* copy = (uint8_t*)malloc(length > 0 ? length : 1);
+		memcpy(copy, data, length);
+		return romimage_register(copy, length, hash, false);
+	}
+
+	RomImage* RomImage::romimage_mapFile(const char* path) {
+		const uint8_t* data = NULL;
+		int length = 0;
+		bool mapped = false;
+		#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(file != INVALID_HANDLE_VALUE) {
+			LARGE_INTEGER size;
+			if(GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart < 0x7fffffff) {
+				HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if(mapping != NULL) {
+					// the view keeps the mapping alive
+					data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					length = (int) size.QuadPart;
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+		}
+		#else
+		int fd = open(path, O_RDONLY);
+		if(fd >= 0) {
+			struct stat info;
+			if(fstat(fd, &info) == 0 && info.st_size > 0 && info.st_size < 0x7fffffff) {
+				void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if(view != MAP_FAILED) {
+					data = (const uint8_t*)view;
+					length = (int) info.st_size;
+				}
+			}
+			close(fd);
+		}
+		#endif
+		if(data != NULL) {
+			mapped = true;
+		} else {
+			// can't be mapped, read it in instead
+			FILE* f = fopen(path, "rb");
+			if(f == NULL) return NULL;
+			fseek(f, 0, SEEK_END);
+			length = ftell(f);
+			rewind(f);
+			if(length <= 0) {
+				fclose(f);
+				return NULL;
+			}
+			uint8_t* buffer = (uint8_t*)malloc(length);
+			if(fread(buffer, length, 1, f) != 1) {
+				fclose(f);
+				free(buffer);
+				return NULL;
+			}
+			fclose(f);
+			data = buffer;
+		}
+		return romimage_adopt(data, length, mapped);
+	}
+
+	RomImage* RomImage::romimage_load(const char* path) {
+		FILE* f = fopen(path, "rb");
+		if(f == NULL) return NULL;
+		uint8_t magic[4] = {0};
+		size_t got = fread(magic, 1, 4, f);
+		uint8_t* data = NULL;
+		int length = 0;
+		if(got == 4 && magic[0] == 'P' && magic[1] == 'K' && magic[2] == 3 && magic[3] == 4) {
+			fclose(f);
+			data = readZip(path, &length);
+		} else if(got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+			fseek(f, 2, SEEK_SET);
+			data = readGzip(f, &length);
+			fclose(f);
+		} else {
+			fclose(f);
+			return romimage_mapFile(path);
+		}
+		if(data == NULL) return NULL;
+		return romimage_adopt(data, length, false);
+	}
+
+	int RomImage::romimage_count() {
+		std::lock_guard<std::mutex> guard(romimage_lock);
+		return (int) romimage_registry.size();
+	}
+
+	RomImage* RomImage::romimage_adopt(const uint8_t* data, int length, bool mapped) {
+		uint64_t hash = romimage_hash(data, length);
+		std::unique_lock<std::mutex> guard(romimage_lock);
+		auto found = romimage_registry.find(hash);
+		// the hash only finds the candidate, sharing it takes the same bytes
+		if(found != romimage_registry.end() && found->second->length == length && memcmp(found->second->data, data, length) == 0) {
+			// already loaded, drop this copy
+			RomImage* image = found->second;
+			image->refs++;
+			guard.unlock();
+			romimage_freeData(data, length, mapped);
+			return image;
+		}
+		return romimage_register(data, length, hash, mapped);
+	}
+
+	RomImage* RomImage::romimage_register(const uint8_t* data, int length, uint64_t hash, bool mapped) {
+		RomImage* image = new RomImage();
+		image->data = data;
+		image->length = length;
+		image->hash = hash;
+		image->refs = 1;
+		image->mapped = mapped;
+		image->romimage_parse();
+		// only replaces one on a hash collision, which then stays unregistered
+		romimage_registry[hash] = image;
+		return image;
+	}
+
+	void RomImage::romimage_freeData(const uint8_t* data, int length, bool mapped) {
+		if(mapped) {
+			#ifdef _WIN32
+			UnmapViewOfFile(data);
+			#else
+			munmap((void*)data, length);
+			#endif
+		} else {
+			free((void*)data);
+		}
+	}
+
+	void RomImage::romimage_retain() {
+		std::lock_guard<std::mutex> guard(romimage_lock);
+		refs++;
+	}
+
+	void RomImage::romimage_release() {
+		{
+			std::lock_guard<std::mutex> guard(romimage_lock);
+			if(--refs > 0) return;
+			auto found = romimage_registry.find(hash);
+			if(found != romimage_registry.end() && found->second == this) romimage_registry.erase(found);
+		}
+		romimage_freeData(data, length, mapped);
+		delete this;
+	}
+
+	uint64_t RomImage::romimage_hash(const uint8_t* data, int length) {
+		const uint8_t* p = data;
+		const uint8_t* end = data + length;
+		uint64_t h;
+		if(length >= 32) {
+			uint64_t v1 = xxh64_prime1 + xxh64_prime2;
+			uint64_t v2 = xxh64_prime2;
+			uint64_t v3 = 0;
+			uint64_t v4 = 0 - xxh64_prime1;
+			while(end - p >= 32) {
+				v1 = xxh64_round(v1, xxh64_read64(p));
+				v2 = xxh64_round(v2, xxh64_read64(p + 8));
+				v3 = xxh64_round(v3, xxh64_read64(p + 16));
+				v4 = xxh64_round(v4, xxh64_read64(p + 24));
+				p += 32;
+			}
+			h = xxh64_rotl(v1, 1) + xxh64_rotl(v2, 7) + xxh64_rotl(v3, 12) + xxh64_rotl(v4, 18);
+			h = xxh64_merge(h, v1);
+			h = xxh64_merge(h, v2);
+			h = xxh64_merge(h, v3);
+			h = xxh64_merge(h, v4);
+		} else {
+			h = xxh64_prime5;
+		}
+		h += (uint64_t) length;
+		while(end - p >= 8) {
+			h ^= xxh64_round(0, xxh64_read64(p));
+			h = xxh64_rotl(h, 27) * xxh64_prime1 + xxh64_prime4;
+			p += 8;
+		}
+		if(end - p >= 4) {
+			uint32_t v;
+			memcpy(&v, p, 4);
+			h ^= (uint64_t) v * xxh64_prime1;
+			h = xxh64_rotl(h, 23) * xxh64_prime2 + xxh64_prime3;
+			p += 4;
+		}
+		while(p < end) {
+			h ^= *p++ * xxh64_prime5;
+			h = xxh64_rotl(h, 11) * xxh64_prime1;
+		}
+		h ^= h >> 33;
+		h *= xxh64_prime2;
+		h ^= h >> 29;
+		h *= xxh64_prime3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	void RomImage::romimage_parse() {
+		// check headers
+		CartHeader headers[6];
+		memset(headers, 0, sizeof(headers));
+		for(int i = 0; i < 6; i++) {
+			headers[i].score = -50;
+		}
+		if(length >= 0x8000) readHeader(data, length, 0x7fc0, &headers[0]); // lorom
+		if(length >= 0x8200) readHeader(data, length, 0x81c0, &headers[1]); // lorom + header
+		if(length >= 0x10000) readHeader(data, length, 0xffc0, &headers[2]); // hirom
+		if(length >= 0x10200) readHeader(data, length, 0x101c0, &headers[3]); // hirom + header
+		if(length >= 0x410000) readHeader(data, length, 0x40ffc0, &headers[4]); // exhirom
+		if(length >= 0x410200) readHeader(data, length, 0x4101c0, &headers[5]); // exhirom + header
+		// see which it is, go backwards to allow picking ExHiROM over HiROM for roms with headers in both spots
+		int max = 0;
+		int used = 0;
+		for(int i = 5; i >= 0; i--) {
+			if(headers[i].score > max) {
+				max = headers[i].score;
+				used = i;
+			}
+		}
+		header = headers[used];
+		// odd-numbered ones are for headered roms
+		romOffset = (used & 1) ? 0x200 : 0;
+		bankSize = used >= 2 ? 0x10000 : 0x8000; // 0, 1: LoROM, else HiROM
+		// coprocessor check
+		if (header.exCoprocessor == 0x10) {
+			header.cartType = 4; // cx4
+		}
+	}
+
+}
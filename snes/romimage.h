@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace LakeSnes
+{
+	struct CartHeader {
+		// normal header
+		uint8_t headerVersion; // 1, 2, 3
+		char name[22]; // $ffc0-$ffd4 (max 21 bytes + \0), $ffd4=$00: header V2
+		uint8_t speed; // $ffd5.7-4 (always 2 or 3)
+		uint8_t type; // $ffd5.3-0
+		uint8_t coprocessor; // $ffd6.7-4
+		uint8_t chips; // $ffd6.3-0
+		uint32_t romSize; // $ffd7 (0x400 << x)
+		uint32_t ramSize; // $ffd8 (0x400 << x)
+		uint8_t region; // $ffd9 (also NTSC/PAL)
+		uint8_t maker; // $ffda ($33: header V3)
+		uint8_t version; // $ffdb
+		uint16_t checksumComplement; // $ffdc,$ffdd
+		uint16_t checksum; // $ffde,$ffdf
+		// v2/v3 (v2 only exCoprocessor)
+		char makerCode[3]; // $ffb0,$ffb1: (2 chars + \0)
+		char gameCode[5]; // $ffb2-$ffb5: (4 chars + \0)
+		uint32_t flashSize; // $ffbc (0x400 << x)
+		uint32_t exRamSize; // $ffbd (0x400 << x) (used for GSU?)
+		uint8_t specialVersion; // $ffbe
+		uint8_t exCoprocessor; // $ffbf (if coprocessor = $f)
+		// calculated stuff
+		int16_t score; // score for header, to see which mapping is most likely
+		bool pal; // if this is a rom for PAL regions instead of NTSC
+		uint8_t cartType; // calculated type
+	};
+
+	// A rom file's contents, immutable and shared by any number of carts (in any number of Snes instances).
+	// Images are registered process-wide by a hash of the contents, so creating one for contents that are
+	// already loaded gives the existing image (and its header, parsed once) instead of another copy; a hash
+	// match is only shared after comparing the bytes.
+	// Refcounted: creating one gives a reference, every cart that loads it takes one, and the last release
+	// frees it (or unmaps the file). All of it is thread safe.
+	class RomImage
+	{
+	public:
+		// the registered image for these contents, or a new one with a copy of data
+		static RomImage* romimage_create(const uint8_t* data, int length);
+		// likewise for a file's contents; a new image maps the file read-only (or reads it in where that isn't
+		// possible). NULL if the file can't be read
+		static RomImage* romimage_mapFile(const char* path);
+		// a rom file that can also be zipped (the first .sfc/.smc in it) or gzipped; those are inflated straight
+		// into the image's memory, sized up front from the archive, raw files are mapped as above
+		static RomImage* romimage_load(const char* path);
+		// registered images, for checking on sharing
+		static int romimage_count();
+		static uint64_t romimage_hash(const uint8_t* data, int length); // xxh64
+		void romimage_retain();
+		void romimage_release();
+
+	private:
+		// registers data (taking it over), or drops it for the image already registered with the same contents
+		static RomImage* romimage_adopt(const uint8_t* data, int length, bool mapped);
+		static RomImage* romimage_register(const uint8_t* data, int length, uint64_t hash, bool mapped);
+		static void romimage_freeData(const uint8_t* data, int length, bool mapped);
+		void romimage_parse();
+
+	public:
+		const uint8_t* data;
+		int length;
+		uint64_t hash;
+		// from the best scoring of the possible headers
+		CartHeader header;
+		int romOffset; // 0x200 past a copier header
+		int bankSize; // 0x8000 for lorom, 0x10000 for hirom
+
+	private:
+		int refs; // under the registry's lock
+		bool mapped; // else malloc'ed
+	};
+
+}
@@ -9,11 +9,19 @@
 #include "cart.h"
 #include "cx4.h"
 #include "input.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
 
 namespace LakeSnes
 {
@@ -27,6 +35,8 @@ namespace LakeSnes
 		mycart.cart_init(this);
 		myinput[0].input_init(0);
 		myinput[1].input_init(1);
+		mytracer.tracer_init(this);
+		myprofiler.profiler_init(this);
 		palTiming = false;
 		return this;
 	}
@@ -36,6 +46,39 @@ namespace LakeSnes
 		mycart.cart_free();
 		myinput[0].input_free();
 		myinput[1].input_free();
+		mytracer.tracer_free();
+		myprofiler.profiler_free();
+		snes_setAudioSink(NULL, NULL);
+		snes_closeAudioStream();
+	}
+
+	void* Snes::operator new(size_t size) {
+		#ifdef LAKESNES_CONFIG_HUGEPAGES
+		// the whole object in one 2MB page (where transparent huge pages are on), instead of a hundred small ones
+		const size_t align = 0x200000;
+		#else
+		const size_t align = LAKESNES_PAGE;
+		#endif
+		size = (size + align - 1) & ~(align - 1);
+		void* p = NULL;
+		#ifdef _WIN32
+		p = _aligned_malloc(size, align);
+		#else
+		if(posix_memalign(&p, align, size) != 0) p = NULL;
+		#endif
+		if(p == NULL) throw std::bad_alloc();
+		#if defined(LAKESNES_CONFIG_HUGEPAGES) && defined(MADV_HUGEPAGE)
+		madvise(p, size, MADV_HUGEPAGE);
+		#endif
+		return p;
+	}
+
+	void Snes::operator delete(void* p) {
+		#ifdef _WIN32
+		_aligned_free(p);
+		#else
+		free(p);
+		#endif
 	}
 
 	void Snes::snes_reset(bool hard) {
@@ -47,6 +90,8 @@ namespace LakeSnes
 		myinput[1].input_reset();
 		mycart.cart_reset();
 		if(hard) memset(ram, 0, sizeof(ram));
+		memset(&stats, 0, sizeof(stats));
+		memset(&frameStats, 0, sizeof(frameStats));
 		ramAdr = 0;
 		hPos = 0;
 		vPos = 0;
@@ -75,6 +120,7 @@ namespace LakeSnes
 	}
 
 	void Snes::snes_runFrame() {
+		LAKESNES_TIMELINE_SCOPE(this, "snes_runFrame");
 		while(inVblank) {
 			mycpu.cpu_runOpcode();
 		}
@@ -105,6 +151,32 @@ namespace LakeSnes
 		}
 	}
 
+	int Snes::snes_cyclesToEvent() {
+		int limit = nextHoriEvent;
+		if(hPos < 536 && limit > 536) limit = 536;
+		if(hIrqEnabled && hTimer * 4 > hPos && hTimer * 4 < limit) limit = hTimer * 4;
+		// stop short of the position itself, which has to go through snes_runCycle
+		return limit - hPos - 1;
+	}
+
+	void Snes::snes_skipCycles(int nCycles) {
+		// same as snes_runCycles, as long as nothing positional is crossed
+		cycles += nCycles;
+		hPos += nCycles;
+		// the irq condition can't change within the span, but it can become true at its start
+		bool condition = (
+			(vIrqEnabled || hIrqEnabled) &&
+			(vPos == vTimer || !vIrqEnabled) &&
+			(hPos == hTimer * 4 || !hIrqEnabled)
+		);
+		if(!irqCondition && condition) {
+			inIrq = true;
+			mycpu.cpu_setIrq(true);
+		}
+		irqCondition = condition;
+		autoJoyTimer = autoJoyTimer > nCycles ? autoJoyTimer - nCycles : 0;
+	}
+
 	void Snes::snes_runCycle() {
 		cycles += 2;
 		// increment position
@@ -184,6 +256,10 @@ namespace LakeSnes
 					if(startingVblank) {
 						// catch up the apu at end of emulated frame (we end frame @ start of vblank)
 						snes_catchupApu();
+						#ifdef LAKESNES_CONFIG_STATS
+						frameStats = stats;
+						memset(&stats, 0, sizeof(stats));
+						#endif
 						// notify dsp of frame-end, because sometimes dma will extend much further past vblank (or even into the next frame)
 						// Megaman X2 (titlescreen animation), Tales of Phantasia (game demo), Actraiser 2 (fade-in @ bootup)
 						myapu.mydsp.dsp_newFrame();
@@ -208,6 +284,7 @@ namespace LakeSnes
 	}
 
 	void Snes::snes_catchupApu() {
+		LAKESNES_STAT(this, apuCatchups, 1);
 		myapu.apu_runCycles();
 	}
 
@@ -431,8 +508,8 @@ namespace LakeSnes
 		if(adr >= 0x4300 && adr < 0x4380) {
 			return mydma.dma_read(adr); // dma registers
 		}
-		LAKESNES_UNREACHABLE;
-		return 0;
+		// the holes in the io block ($2000-$20ff, $4000-$41ff, ...) are reachable, by dma too
+		return OpenBusRef();
 	}
 
 	void Snes::snes_writeIO(uint16_t adr, uint8_t val)
@@ -465,6 +542,26 @@ namespace LakeSnes
 		myapu.myspc.spc_runOpcode();
 	}
 
+	void Snes::snes_setTracing(int records) {
+		#ifdef LAKESNES_CONFIG_TRACE
+		mytracer.tracer_enable(records);
+		#else
+		if(records > 0) puts("Tracing is not compiled in (LAKESNES_CONFIG_TRACE)");
+		#endif
+	}
+
+	void Snes::snes_setProfiling(bool enabled) {
+		#ifdef LAKESNES_CONFIG_PROFILE
+		myprofiler.profiler_enable(enabled);
+		#else
+		if(enabled) puts("Profiling is not compiled in (LAKESNES_CONFIG_PROFILE)");
+		#endif
+	}
+
+	void Snes::snes_getStats(SnesStats* stats) {
+		*stats = frameStats;
+	}
+
 	uint8_t Snes::snes_peekByte(uint32_t addr24)
 	{
 		// TODO: this can have side effects, implement and use proper peeking
@@ -1,22 +1,55 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <array>
 
+#include "conf.h"
 #include "cpu.h"
 #include "dma.h"
 #include "apu.h"
 #include "ppu.h"
 #include "cart.h"
 #include "input.h"
+#include "trace.h"
+#include "profile.h"
 #include "Add24.h"
 
 namespace LakeSnes
 {
 	struct SnesConfig
 	{
-		//Donate this memory to the PPU so it can draw the framebuffer in there
-		uint8_t *pixelBufferRGBX8888_512x239x2;
+		//Donate this memory to the PPU so it can draw the framebuffer in there, pixelPitch * 478 bytes.
+		//Line y (1-239) of a field goes to row (y - 1) * 2 + (even field ? 0 : 1), so an interlaced frame comes out
+		//woven; for a progressive one, take every other row starting at its field (see Ppu::GetFramebufferInfo).
+		uint8_t *pixelBuffer = NULL;
+		PixelFormat pixelFormat = PixelFormat::XRGB8888;
+		int pixelPitch = 0; // bytes per row, 0 for tightly packed
+		bool pixelHires = true; // 512 pixels per row (all hi-res columns), or 256 (only the main screen's)
+
+		//Older way to pass a 512 wide XRGB8888 pixelBuffer, used when pixelBuffer is NULL (needed by snes_setPixels)
+		uint8_t *pixelBufferRGBX8888_512x239x2 = NULL;
+	};
+
+	//Counts of what the emulation did over one frame (from the start of one vblank to the next), to see
+	//which part dominates for a game. Only counted when built with LAKESNES_CONFIG_STATS, otherwise all 0.
+	struct SnesStats
+	{
+		uint64_t cpuInstructions[2][2]; // by [x flag][m flag] (1 for 8 bit), as run by TCpu<XF,MF>
+		uint64_t cpuInterrupts; // nmi/irq/brk-style entries taken instead of an opcode
+		// cpu bus accesses (not dma) by region, as classified in cpu_access_new
+		uint64_t busWram; // 7e-7f
+		uint64_t busLowRam; // 00-3f,80-bf:0000-1fff
+		uint64_t busCart[2]; // whatever the cart maps (rom, sram...), in banks 00-7f and 80-ff
+		uint64_t busIo; // 00-3f,80-bf:2000-5fff
+		uint64_t dmaBytes;
+		uint64_t dmaBulkBytes; // part of dmaBytes, done in bulk by dma_bulkTransfer
+		uint64_t hdmaBytes;
+		uint64_t spcInstructions; // opcodes fetched, not the single-cycle steps spc_runOpcode takes for some of them
+		uint64_t dspSamples;
+		uint64_t ppuLines; // lines rendered
+		uint64_t ppuLinesUnchanged; // part of ppuLines, same as in the previous frame (see Ppu::FramebufferInfo)
+		uint64_t apuCatchups;
 	};
 
 	class Snes
@@ -29,6 +62,10 @@ namespace LakeSnes
 		// used by dma, cpu
 		void snes_runCycles(int cycles);
 		void snes_syncCycles(bool start, int syncCycles);
+		// used by bulk dma: cycles that can pass without reaching a horizontal event, the dram refresh or the
+		// h-irq position, and advancing by at most that many in one go
+		int snes_cyclesToEvent();
+		void snes_skipCycles(int nCycles);
 		uint8_t snes_readBBus(uint8_t adr);
 		void snes_writeBBus(uint8_t adr, uint8_t val);
 		void snes_writeIO(uint16_t adr, uint8_t val);
@@ -38,21 +75,54 @@ namespace LakeSnes
 		void snes_runCpuCycle();
 		void snes_runSpcCycle();
 		uint8_t snes_peekByte(uint32_t addr24);
+		// execution trace (only with LAKESNES_CONFIG_TRACE): keep the last records (rounded up to a power of 2)
+		// executed instructions, 0 turns it off; read them with mytracer.tracer_copy
+		void snes_setTracing(int records);
+		// hot code profile (only with LAKESNES_CONFIG_PROFILE): start/stop adding to it, see myprofiler
+		void snes_setProfiling(bool enabled);
+		// counters of the last finished frame (only with LAKESNES_CONFIG_STATS)
+		void snes_getStats(SnesStats* stats);
 
 		// snes_other.c functions:
 
-		bool snes_loadRom(const uint8_t* data, int length);
+		bool snes_loadRom(const uint8_t* data, int length); // copies data
+		// shares the image (see RomImage), so any number of instances can run one rom with a single copy of it
+		bool snes_loadRomImage(RomImage* image);
 
 		// playerNumber shall be 1 or 2 (playerNumber 0 is not valid)
 		void snes_setButtonState(int playerNumber, int button, bool pressed);
 
+		// copies the frame to a 512x480 XRGB8888 image, line-doubled; for the default pixel format and width only
 		void snes_setPixels(uint8_t* pixelData);
+		// zero-copy frame handoff: the ppu renders straight into one of three caller-owned buffers (each laid out
+		// as SnesConfig::pixelBuffer, in its format) and publishes every finished frame at the start of vblank.
+		// A consumer on any one other thread takes the newest one with snes_acquireFrame (NULL if there is no newer
+		// one than it holds); the buffer it got stays untouched until its next acquire. Frames it is too slow for are
+		// skipped, and sequence tells by how many. Set (or clear with NULL) while nothing is running.
+		void snes_setFrameSlots(uint8_t* slots[3]);
+		const uint8_t* snes_acquireFrame(Ppu::FramebufferInfo* info, uint64_t* sequence);
 		void snes_setSamples(int16_t* sampleData, int samplesPerFrame);
+		// apu-only playback: load a .spc snapshot, then run just the apu (output via the audio sink/stream)
+		bool snes_loadSpc(const uint8_t* data, int length);
+		void snes_runApuSamples(int samples);
+		// streaming audio: the dsp output is queued as it is produced and can be read at any rate,
+		// from any one other thread (e.g. an audio callback); latencyMs is the queue depth aimed for
+		void snes_openAudioStream(int outputRate, int latencyMs);
+		void snes_closeAudioStream();
+		void snes_readAudioStream(int16_t* sampleData, int frames);
+		// lossless capture: every native (32 kHz) frame goes to sink in batches, NULL stops capturing
+		// (frames still batched are delivered first); see AudioWriter for a file sink
+		void snes_setAudioSink(AudioSink sink, void* userdata);
+		void snes_flushAudioSink();
 		int snes_saveBattery(uint8_t* data);
 		bool snes_loadBattery(uint8_t* data, int size);
 		int snes_saveState(uint8_t* data);
 		bool snes_loadState(uint8_t* data, int size);
 
+		// page aligned (LAKESNES_PAGE), or with LAKESNES_CONFIG_HUGEPAGES, on huge pages where the os has them
+		static void* operator new(size_t size);
+		static void operator delete(void* p);
+
 		uint8_t& OpenBusRef()
 		{
 			return mycpu._currAddr24._openBus;
@@ -71,8 +141,10 @@ namespace LakeSnes
 		Cpu mycpu;
 		Dma mydma;
 
+		// timing core: frame timing, interrupts and the other registers every cycle (snes_runCycle) or access
+		// touches, all in one cache line (which cpu and dma end right before)
 		// frame timing
-		uint64_t cycles;
+		alignas(LAKESNES_CACHE_LINE) uint64_t cycles;
 		uint16_t hPos;
 		uint16_t vPos;
 		uint32_t frames;
@@ -106,7 +178,7 @@ namespace LakeSnes
 		uint32_t ramAdr;
 
 		// ram goes after all the sundry stuff so the sundry can stay together
-		uint8_t ram[0x20000];
+		alignas(LAKESNES_PAGE) uint8_t ram[0x20000];
 
 		//TODO: mmore organizing
 		Apu myapu;
@@ -114,6 +186,11 @@ namespace LakeSnes
 		bool palTiming;
 		// input
 		std::array<Input,2> myinput;
+		// debugging
+		Tracer mytracer;
+		Profiler myprofiler;
+		SnesStats stats; // current frame so far
+		SnesStats frameStats; // last finished frame
 
 		//ppu at end for now because it's a large mess
 		Ppu myppu;
@@ -121,4 +198,9 @@ namespace LakeSnes
 		SnesConfig snesConfig;
 	};
 
+	// layout checks, keep these holding when adding members
+	static_assert(offsetof(Snes, ramAdr) + sizeof(uint32_t) - offsetof(Snes, cycles) <= LAKESNES_CACHE_LINE, "the timing core should fit in one cache line");
+	static_assert(offsetof(Snes, cycles) - offsetof(Snes, mycpu) <= 4 * LAKESNES_CACHE_LINE, "cpu and dma should stay in the lines right before it");
+	static_assert(offsetof(Snes, ram) % LAKESNES_PAGE == 0, "ram should start on a page");
+
 }
@@ -1,5 +1,7 @@
 #include "spc.h"
 #include "apu.h"
+#include "snes.h"
+#include "conf.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,12 +39,27 @@ namespace LakeSnes
 		step = 0;
 	}
 
+	void Spc::spc_setRegisters(uint16_t pc, uint8_t a, uint8_t x, uint8_t y, uint8_t psw, uint8_t sp) {
+		this->pc = pc;
+		this->a = a;
+		this->x = x;
+		this->y = y;
+		this->sp = sp;
+		spc_setFlags(psw);
+		stopped = false;
+		resetWanted = false;
+		step = 0;
+	}
+
 	// Actraiser 2, Rendering Ranger B2, and a handful of other games have
 	// very tight timing constraints while processing uploads from the main cpu.
 	// Certain select opcodes as well as all 2-cycle (1 fetch, 1 exec_insn) run
 	// in single-cycle mode.   -dink sept 15, 2023
 
 	void Spc::spc_runOpcode() {
+		#ifdef LAKESNES_CONFIG_PROFILE
+		ProfileSpcScope profileScope(config.snes->myprofiler.enabled ? &config.snes->myprofiler : NULL);
+		#endif
 		if(resetWanted) {
 			// based on 6502, brk without writes
 			resetWanted = false;
@@ -61,6 +78,7 @@ namespace LakeSnes
 			return;
 		}
 		if (step == 0) {
+			LAKESNES_STAT(config.snes, spcInstructions, 1);
 			bstep = 0;
 			opcode = spc_readOpcode();
 			step = 1;
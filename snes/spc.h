@@ -48,6 +48,7 @@ namespace LakeSnes
 		void spc_free();
 		void spc_reset(bool hard);
 		void spc_runOpcode();
+		void spc_setRegisters(uint16_t pc, uint8_t a, uint8_t x, uint8_t y, uint8_t psw, uint8_t sp); // for loading snapshots
 
 	private:
 		uint8_t spc_read(uint16_t adr);
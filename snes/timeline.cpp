@@ -0,0 +1,220 @@
+#include "timeline.h"
+#include "snes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace
+{
+	// one per thread that ever recorded, kept for the process' lifetime; the thread writes, the writer reads
+	struct TimelineBuffer
+	{
+		static const uint32_t size = 0x4000;
+		LakeSnes::TimelineEvent events[size];
+		std::atomic<uint32_t> writePos{0};
+		std::atomic<uint32_t> readPos{0};
+		std::atomic<uint32_t> dropped{0}; // while the ring was full
+		uint32_t tid;
+		char name[32];
+		uint32_t namedSession = 0; // session its name was last written in (writer only)
+		TimelineBuffer* next;
+	};
+
+	std::atomic<TimelineBuffer*> timeline_buffers{nullptr};
+	std::atomic<uint32_t> timeline_nextTid{1};
+	thread_local TimelineBuffer* timeline_threadBuffer = nullptr;
+
+	std::atomic<bool> timeline_active{false};
+
+	TimelineBuffer* timeline_getBuffer(const char* name) {
+		if(timeline_threadBuffer != nullptr) return timeline_threadBuffer;
+		TimelineBuffer* buffer = new TimelineBuffer();
+		buffer->tid = timeline_nextTid.fetch_add(1);
+		if(name != NULL) {
+			snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+		} else {
+			snprintf(buffer->name, sizeof(buffer->name), "thread %u", buffer->tid);
+		}
+		// publish (the writer only walks the list)
+		buffer->next = timeline_buffers.load();
+		while(!timeline_buffers.compare_exchange_weak(buffer->next, buffer)) {}
+		timeline_threadBuffer = buffer;
+		return buffer;
+	}
+
+	#ifdef LAKESNES_CONFIG_TIMELINE
+	// the writer
+	FILE* timeline_file = NULL;
+	uint64_t timeline_origin; // host ns at timeline_open
+	uint32_t timeline_session = 0;
+	bool timeline_firstEvent;
+	std::thread timeline_thread;
+	std::mutex timeline_lock;
+	std::condition_variable timeline_signal;
+	bool timeline_closing;
+
+	void timeline_separate() {
+		fputs(timeline_firstEvent ? "\n" : ",\n", timeline_file);
+		timeline_firstEvent = false;
+	}
+
+	// as a quoted json string
+	void timeline_writeString(const char* text) {
+		fputc('"', timeline_file);
+		for(const char* c = text; *c != '\0'; c++) {
+			if(*c == '"' || *c == '\\') {
+				fputc('\\', timeline_file);
+				fputc(*c, timeline_file);
+			} else if((uint8_t)*c < 0x20) {
+				fprintf(timeline_file, "\\u%04x", (uint8_t)*c);
+			} else {
+				fputc(*c, timeline_file);
+			}
+		}
+		fputc('"', timeline_file);
+	}
+
+	void timeline_drain() {
+		for(TimelineBuffer* buffer = timeline_buffers.load(); buffer != nullptr; buffer = buffer->next) {
+			if(buffer->namedSession != timeline_session) {
+				buffer->namedSession = timeline_session;
+				timeline_separate();
+				fprintf(timeline_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buffer->tid);
+				timeline_writeString(buffer->name);
+				fputs("}}", timeline_file);
+			}
+			uint32_t r = buffer->readPos.load(std::memory_order_relaxed);
+			uint32_t w = buffer->writePos.load(std::memory_order_acquire);
+			for(; r != w; r++) {
+				const LakeSnes::TimelineEvent& event = buffer->events[r & (TimelineBuffer::size - 1)];
+				// started before this session (the scope was open across timeline_open)
+				if(event.start < timeline_origin) continue;
+				timeline_separate();
+				fputs("{\"name\":", timeline_file);
+				timeline_writeString(event.name);
+				fprintf(
+					timeline_file,
+					",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u,\"line\":%u}}",
+					buffer->tid, (event.start - timeline_origin) / 1000.0, event.duration / 1000.0,
+					event.frame, event.line
+				);
+			}
+			buffer->readPos.store(w, std::memory_order_release);
+		}
+	}
+
+	void timeline_run() {
+		std::unique_lock<std::mutex> guard(timeline_lock);
+		while(!timeline_closing) {
+			timeline_signal.wait_for(guard, std::chrono::milliseconds(10));
+			guard.unlock();
+			timeline_drain();
+			guard.lock();
+		}
+	}
+	#endif
+}
+
+namespace LakeSnes
+{
+	bool timeline_open(const char* path) {
+		#ifndef LAKESNES_CONFIG_TIMELINE
+		(void)path;
+		puts("Timeline is not compiled in (LAKESNES_CONFIG_TIMELINE)");
+		return false;
+		#else
+		timeline_close();
+		timeline_file = fopen(path, "w");
+		if(timeline_file == NULL) {
+			printf("Failed to open '%s' for the timeline\n", path);
+			return false;
+		}
+		fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", timeline_file);
+		timeline_firstEvent = true;
+		timeline_session++;
+		timeline_origin = timeline_now();
+		// drop whatever was left over from an earlier session
+		for(TimelineBuffer* buffer = timeline_buffers.load(); buffer != nullptr; buffer = buffer->next) {
+			buffer->readPos.store(buffer->writePos.load(std::memory_order_acquire), std::memory_order_release);
+			buffer->dropped.store(0);
+		}
+		timeline_closing = false;
+		timeline_thread = std::thread(timeline_run);
+		timeline_active.store(true);
+		return true;
+		#endif
+	}
+
+	void timeline_close() {
+		#ifdef LAKESNES_CONFIG_TIMELINE
+		if(timeline_file == NULL) return;
+		timeline_active.store(false);
+		{
+			std::lock_guard<std::mutex> guard(timeline_lock);
+			timeline_closing = true;
+			timeline_signal.notify_all();
+		}
+		timeline_thread.join();
+		// (scopes still running now are left out)
+		timeline_drain();
+		fputs("\n]}\n", timeline_file);
+		fclose(timeline_file);
+		timeline_file = NULL;
+		uint32_t dropped = 0;
+		for(TimelineBuffer* buffer = timeline_buffers.load(); buffer != nullptr; buffer = buffer->next) {
+			dropped += buffer->dropped.load();
+		}
+		if(dropped > 0) printf("Timeline: dropped %u events (the writer fell behind)\n", dropped);
+		#endif
+	}
+
+	bool timeline_isOpen() {
+		return timeline_active.load(std::memory_order_relaxed);
+	}
+
+	void timeline_nameThread(const char* name) {
+		timeline_getBuffer(name);
+	}
+
+	void timeline_record(const TimelineEvent& event) {
+		TimelineBuffer* buffer = timeline_getBuffer(NULL);
+		uint32_t w = buffer->writePos.load(std::memory_order_relaxed);
+		if(w - buffer->readPos.load(std::memory_order_acquire) >= TimelineBuffer::size) {
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		buffer->events[w & (TimelineBuffer::size - 1)] = event;
+		buffer->writePos.store(w + 1, std::memory_order_release);
+	}
+
+	uint64_t timeline_now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+
+	TimelineScope::TimelineScope(Snes* snes, const char* name) {
+		if(!timeline_isOpen()) {
+			event.name = NULL;
+			return;
+		}
+		event.name = name;
+		event.frame = snes != NULL ? snes->frames : 0;
+		event.line = snes != NULL ? snes->vPos : 0;
+		event.start = timeline_now();
+	}
+
+	TimelineScope::~TimelineScope() {
+		if(event.name == NULL) return;
+		event.duration = timeline_now() - event.start;
+		timeline_record(event);
+	}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace LakeSnes
+{
+	class Snes;
+
+	// Timeline of where the host time goes (frames, lines, dma, apu catch-up...), to see overlap and stalls
+	// between threads. When built with LAKESNES_CONFIG_TIMELINE, LAKESNES_TIMELINE_SCOPE marks the rest of the
+	// enclosing block as an event, tagged with the emulated frame and scanline it started on (without the define
+	// the scopes aren't compiled at all). Each thread records into its own ring without locking, a background
+	// thread drains the rings into a Chrome trace-event JSON file (chrome://tracing or ui.perfetto.dev open it).
+	// One timeline per process.
+	struct TimelineEvent
+	{
+		const char* name; // static string
+		uint64_t start; // host ns, see timeline_now
+		uint64_t duration;
+		uint32_t frame;
+		uint16_t line;
+	};
+
+	// starts writing to path, false if the file can't be opened (or the timeline isn't compiled in)
+	bool timeline_open(const char* path);
+	// stops after writing out what was recorded so far
+	void timeline_close();
+	bool timeline_isOpen();
+	// names the calling thread in the timeline, before its first event
+	void timeline_nameThread(const char* name);
+	void timeline_record(const TimelineEvent& event);
+	uint64_t timeline_now();
+
+	class TimelineScope
+	{
+	public:
+		TimelineScope(Snes* snes, const char* name);
+		~TimelineScope();
+
+	private:
+		TimelineEvent event;
+	};
+
+}
+
+#ifdef LAKESNES_CONFIG_TIMELINE
+#define LAKESNES_TIMELINE_SCOPE(snes, name) LakeSnes::TimelineScope timelineScope(snes, name)
+#else
+#define LAKESNES_TIMELINE_SCOPE(snes, name) ((void)0)
+#endif
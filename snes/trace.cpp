@@ -0,0 +1,96 @@
+#include "trace.h"
+#include "snes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+namespace LakeSnes
+{
+	void Tracer::tracer_init(Snes* snes) {
+		this->snes = snes;
+		enabled = false;
+		ring = NULL;
+		mask = 0;
+		writePos.store(0);
+	}
+
+	void Tracer::tracer_free() {
+		enabled = false;
+		free(ring);
+		ring = NULL;
+	}
+
+	void Tracer::tracer_enable(int records) {
+		if(records <= 0) {
+			tracer_free();
+			return;
+		}
+		uint32_t size = 1;
+		while(size < (uint32_t) records) size <<= 1;
+		if(ring == NULL || size != mask + 1) {
+			free(ring);
+			ring = (TraceRecord*)malloc(size * sizeof(TraceRecord));
+			mask = size - 1;
+		}
+		writePos.store(0);
+		enabled = true;
+	}
+
+	void Tracer::tracer_record() {
+		Cpu& cpu = snes->mycpu;
+		uint64_t w = writePos.load(std::memory_order_relaxed);
+		TraceRecord& record = ring[w & mask];
+		record.cycles = snes->cycles;
+		record.pc = cpu.pc;
+		record.a = cpu.a;
+		record.x = cpu.x;
+		record.y = cpu.y;
+		record.sp = cpu.sp;
+		record.dp = cpu.dp;
+		record.hPos = snes->hPos;
+		record.vPos = snes->vPos;
+		record.k = cpu.k;
+		record.db = cpu.db;
+		record.flags = cpu.n << 7 | cpu.v << 6 | cpu._mf << 5 | cpu._xf << 4 | cpu.d << 3 | cpu.i << 2 | cpu.z << 1 | cpu.c;
+		record.state = (cpu.e ? stateEmulation : 0) | (cpu.intWanted ? stateInterrupt : 0);
+		// peek without side effects: only plain memory, the operands may run into the next bank
+		int length = 0;
+		const uint8_t* code = cpu.dma_getReadPointer(cpu.k, cpu.pc, &length);
+		if(length >= 4) {
+			memcpy(record.bytes, code, 4);
+		} else if(code != NULL) {
+			for(int i = 0; i < 4; i++) {
+				uint32_t adr = ((cpu.k << 16) | cpu.pc) + i;
+				code = cpu.dma_getReadPointer((adr >> 16) & 0xff, adr & 0xffff, &length);
+				record.bytes[i] = code != NULL ? *code : 0;
+			}
+		} else {
+			memset(record.bytes, 0, 4);
+			record.state |= stateNoBytes;
+		}
+		writePos.store(w + 1, std::memory_order_release);
+	}
+
+	int Tracer::tracer_copy(TraceRecord* records, int maxRecords) {
+		if(ring == NULL || maxRecords <= 0) return 0;
+		uint64_t end = writePos.load(std::memory_order_acquire);
+		uint64_t count = end < (uint64_t) mask + 1 ? end : (uint64_t) mask + 1;
+		if(count > (uint64_t) maxRecords) count = maxRecords;
+		uint64_t start = end - count;
+		for(uint64_t i = 0; i < count; i++) records[i] = ring[(start + i) & mask];
+		// the recorder may have lapped the oldest ones meanwhile (and be writing the one after its position)
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t now = writePos.load(std::memory_order_relaxed);
+		uint64_t firstIntact = now >= mask ? now - mask : 0;
+		if(firstIntact > start) {
+			uint64_t lost = firstIntact - start;
+			if(lost >= count) return 0;
+			memmove(records, records + lost, (count - lost) * sizeof(TraceRecord));
+			count -= lost;
+		}
+		return (int) count;
+	}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace LakeSnes
+{
+	class Snes;
+
+	// the cpu state right before an instruction (or an interrupt) runs
+	struct TraceRecord
+	{
+		uint64_t cycles; // master cycle
+		uint16_t pc;
+		uint16_t a;
+		uint16_t x;
+		uint16_t y;
+		uint16_t sp;
+		uint16_t dp;
+		uint16_t hPos;
+		uint16_t vPos;
+		uint8_t k;
+		uint8_t db;
+		uint8_t flags; // nvmxdizc, as php pushes them
+		uint8_t state; // Tracer::state* bits
+		uint8_t bytes[4]; // opcode and operands, as in memory
+	};
+	static_assert(sizeof(TraceRecord) == 32, "trace records should stay compact");
+
+	// Execution trace for debugging desyncs at full speed. When built with LAKESNES_CONFIG_TRACE, the cpu
+	// records every instruction into a ring of fixed-size records while enabled, overwriting the oldest
+	// (without the define the hook isn't compiled at all). Only the emulation thread records; any one other
+	// thread can copy out the newest records meanwhile with tracer_copy. See tracing.cpp to turn them into text.
+	class Tracer
+	{
+	public:
+		static const uint8_t stateEmulation = 1; // e flag
+		static const uint8_t stateInterrupt = 2; // an interrupt is taken instead of the opcode at k:pc
+		static const uint8_t stateNoBytes = 4; // k:pc isn't plain memory (io or open bus), bytes are not peeked
+
+		void tracer_init(Snes* snes);
+		void tracer_free();
+		// records is rounded up to a power of 2, 0 disables and frees the ring; not while a copy is in progress
+		void tracer_enable(int records);
+		void tracer_record();
+		// copies the newest records (at most maxRecords, oldest first) that weren't overwritten while copying
+		int tracer_copy(TraceRecord* records, int maxRecords);
+
+	public:
+		Snes* snes;
+		bool enabled = false;
+		TraceRecord* ring = NULL;
+		uint32_t mask;
+		std::atomic<uint64_t> writePos; // free-running
+	};
+
+}
@@ -88,7 +88,9 @@ static const int opcodeTypeSpc[256] = {
 };
 
 static void getDisassemblyCpu(LakeSnes::Snes* snes, char* line);
+static void formatDisassemblyCpu(uint16_t pc, const uint8_t* bytes, bool mf, bool xf, char* line);
 static void getDisassemblySpc(LakeSnes::Snes* snes, char* line);
+static void formatDisassemblySpc(uint16_t pc, const uint8_t* bytes, char* line);
 
 void getProcessorStateCpu(LakeSnes::Snes* snes, char* line) {
   // 0        1         2         3         4         5         6         7         8
@@ -140,13 +142,19 @@ static void getDisassemblyCpu(LakeSnes::Snes* snes, char* line) {
     return;
   }
   // read 4 bytes
-  uint8_t opcode = snes->snes_peekByte(adr);
-  uint8_t byte = snes->snes_peekByte((adr + 1) & 0xffffff);
-  uint8_t byte2 = snes->snes_peekByte((adr + 2) & 0xffffff);
+  uint8_t bytes[4];
+  for(int i = 0; i < 4; i++) bytes[i] = snes->snes_peekByte((adr + i) & 0xffffff);
+  formatDisassemblyCpu(snes->mycpu.pc, bytes, snes->mycpu._mf, snes->mycpu._xf, line);
+}
+
+static void formatDisassemblyCpu(uint16_t pc, const uint8_t* bytes, bool mf, bool xf, char* line) {
+  uint8_t opcode = bytes[0];
+  uint8_t byte = bytes[1];
+  uint8_t byte2 = bytes[2];
   uint16_t word = (byte2 << 8) | byte;
-  uint32_t longv = (snes->snes_peekByte((adr + 3) & 0xffffff) << 16) | word;
-  uint16_t rel = snes->mycpu.pc + 2 + (int8_t) byte;
-  uint16_t rell = snes->mycpu.pc + 3 + (int16_t) word;
+  uint32_t longv = (bytes[3] << 16) | word;
+  uint16_t rel = pc + 2 + (int8_t) byte;
+  uint16_t rell = pc + 3 + (int16_t) word;
   // switch on type
   switch(opcodeType[opcode]) {
     case 0: sprintf(line, "%s", opcodeNames[opcode]); break;
@@ -155,7 +163,7 @@ static void getDisassemblyCpu(LakeSnes::Snes* snes, char* line) {
     case 3: sprintf(line, opcodeNames[opcode], longv); break;
     case 4: {
       char num[5] = "    ";
-      if(snes->mycpu._mf) {
+      if(mf) {
         sprintf(num, "%02x  ", byte);
       } else {
         sprintf(num, "%04x", word);
@@ -165,7 +173,7 @@ static void getDisassemblyCpu(LakeSnes::Snes* snes, char* line) {
     }
     case 5: {
       char num[5] = "    ";
-      if(snes->mycpu._xf) {
+      if(xf) {
         sprintf(num, "%02x  ", byte);
       } else {
         sprintf(num, "%04x", word);
@@ -179,6 +187,103 @@ static void getDisassemblyCpu(LakeSnes::Snes* snes, char* line) {
   }
 }
 
+void getTraceLineCpu(const LakeSnes::TraceRecord* record, char* line) {
+  // same as getProcessorStateCpu, followed by the position in the frame and the master cycle
+  // CPU 12:3456 1234567890123 A:1234 X:1234 Y:1234 SP:1234 DP:1234 DB:12 e nvmxdizc V:123 H:1234 @1234567890
+  char disLine[14] = "             ";
+  if(record->state & LakeSnes::Tracer::stateInterrupt) {
+    sprintf(disLine, "%s", "<interrupt>  ");
+  } else if(record->state & LakeSnes::Tracer::stateNoBytes) {
+    sprintf(disLine, "%s", "<no memory>  ");
+  } else {
+    formatDisassemblyCpu(record->pc, record->bytes, record->flags & 0x20, record->flags & 0x10, disLine);
+  }
+  const char* flagNames = "NVMXDIZC";
+  char flags[9];
+  for(int i = 0; i < 8; i++) {
+    flags[i] = (record->flags & (0x80 >> i)) ? flagNames[i] : flagNames[i] + ('a' - 'A');
+  }
+  flags[8] = 0;
+  sprintf(
+    line, "CPU %02x:%04x %s A:%04x X:%04x Y:%04x SP:%04x DP:%04x DB:%02x %c %s V:%3d H:%4d @%llu",
+    record->k, record->pc, disLine, record->a, record->x, record->y, record->sp, record->dp, record->db,
+    (record->state & LakeSnes::Tracer::stateEmulation) ? 'E' : 'e', flags, record->vPos, record->hPos,
+    (unsigned long long) record->cycles
+  );
+}
+
+bool dumpTraceCpu(LakeSnes::Snes* snes, const char* path) {
+  LakeSnes::Tracer& tracer = snes->mytracer;
+  if(tracer.ring == NULL) {
+    puts("No execution trace recorded");
+    return false;
+  }
+  int size = tracer.mask + 1;
+  LakeSnes::TraceRecord* records = (LakeSnes::TraceRecord*)malloc(size * sizeof(LakeSnes::TraceRecord));
+  int count = tracer.tracer_copy(records, size);
+  FILE* f = fopen(path, "w");
+  if(f == NULL) {
+    printf("Failed to open '%s' for writing\n", path);
+    free(records);
+    return false;
+  }
+  char line[112];
+  for(int i = 0; i < count; i++) {
+    getTraceLineCpu(&records[i], line);
+    fprintf(f, "%s\n", line);
+  }
+  fclose(f);
+  free(records);
+  return true;
+}
+
+bool dumpProfile(LakeSnes::Snes* snes, const char* path, int topCount) {
+  LakeSnes::Profiler& profiler = snes->myprofiler;
+  if(profiler.cpu.entries == NULL) {
+    puts("No profile recorded");
+    return false;
+  }
+  FILE* f = fopen(path, "w");
+  if(f == NULL) {
+    printf("Failed to open '%s' for writing\n", path);
+    return false;
+  }
+  LakeSnes::ProfileEntry* entries = (LakeSnes::ProfileEntry*)malloc(topCount * sizeof(LakeSnes::ProfileEntry));
+  for(int spc = 0; spc < 2; spc++) {
+    uint64_t total = spc ? profiler.spcCycles : profiler.cpuCycles;
+    int count = profiler.profiler_top(spc, entries, topCount);
+    fprintf(
+      f, "%s: %llu %s cycles, %u addresses, top %d\n", spc ? "SPC" : "CPU", (unsigned long long) total,
+      spc ? "apu" : "master", spc ? profiler.spc.used : profiler.cpu.used, count
+    );
+    fprintf(f, "      cycles      %%      count    host us  address  instruction\n");
+    for(int i = 0; i < count; i++) {
+      const LakeSnes::ProfileEntry& entry = entries[i];
+      char disLine[18] = "";
+      char adrLine[8];
+      if(spc) {
+        sprintf(adrLine, "   %04x", entry.key);
+        formatDisassemblySpc(entry.key, entry.bytes, disLine);
+      } else {
+        sprintf(adrLine, "%02x:%04x", (entry.key >> 16) & 0xff, entry.key & 0xffff);
+        if(entry.key & LakeSnes::Profiler::keyInterrupt) {
+          sprintf(disLine, "%s", "<interrupt>  ");
+        } else {
+          formatDisassemblyCpu(entry.key & 0xffff, entry.bytes, entry.flags & 0x20, entry.flags & 0x10, disLine);
+        }
+      }
+      fprintf(
+        f, "%12llu %5.1f%% %10u %10.0f  %s  %s\n", (unsigned long long) entry.cycles,
+        total ? entry.cycles * 100.0 / total : 0.0, entry.count, entry.hostNs / 1000.0, adrLine, disLine
+      );
+    }
+    fprintf(f, "\n");
+  }
+  free(entries);
+  fclose(f);
+  return true;
+}
+
 void getDisassemblySpc(LakeSnes::Snes* snes, char* line) {
   uint16_t adr = snes->myapu.myspc.pc;
   if(snes->myapu.myspc.stopped) {
@@ -186,13 +291,18 @@ void getDisassemblySpc(LakeSnes::Snes* snes, char* line) {
     return;
   }
   // read 3 bytes
-  // TODO: this can have side effects, implement and use peaking
-  uint8_t opcode = snes->myapu.apu_read(adr);
-  uint8_t byte = snes->myapu.apu_read((adr + 1) & 0xffff);
-  uint8_t byte2 = snes->myapu.apu_read((adr + 2) & 0xffff);
+  uint8_t bytes[3];
+  for(int i = 0; i < 3; i++) bytes[i] = snes->myapu.apu_peek((adr + i) & 0xffff);
+  formatDisassemblySpc(adr, bytes, line);
+}
+
+static void formatDisassemblySpc(uint16_t pc, const uint8_t* bytes, char* line) {
+  uint8_t opcode = bytes[0];
+  uint8_t byte = bytes[1];
+  uint8_t byte2 = bytes[2];
   uint16_t word = (byte2 << 8) | byte;
-  uint16_t rel = snes->myapu.myspc.pc + 2 + (int8_t) byte;
-  uint16_t rel2 = snes->myapu.myspc.pc + 2 + (int8_t) byte2;
+  uint16_t rel = pc + 2 + (int8_t) byte;
+  uint16_t rel2 = pc + 2 + (int8_t) byte2;
   uint16_t wordb = word & 0x1fff;
   uint8_t bit = word >> 13;
   // switch on type
@@ -4,8 +4,15 @@
 namespace LakeSnes
 {
 	class Snes;
+	struct TraceRecord;
 }
 
 void getProcessorStateCpu(LakeSnes::Snes* snes, char* line);
 void getProcessorStateSpc(LakeSnes::Snes* snes, char* line);
+// a recorded instruction (see LakeSnes::Tracer) as getProcessorStateCpu shows it, plus when it ran (line needs 112 bytes)
+void getTraceLineCpu(const LakeSnes::TraceRecord* record, char* line);
+// writes the snes' execution trace to a text file, oldest first
+bool dumpTraceCpu(LakeSnes::Snes* snes, const char* path);
+// writes the addresses the cpu and spc spent the most cycles at (see LakeSnes::Profiler), disassembled
+bool dumpProfile(LakeSnes::Snes* snes, const char* path, int topCount);
 